@@ -15,14 +15,39 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef _WIN32
 #include <conio.h>
 #endif
 
+#define AJS_CLI_TEXT_BLOB
 #include "AJScli.h"
 
+// Atomics for command list publishing (see Command Lists below)
+#ifndef CLI_ATOMIC_LOAD
+    #if defined(__GNUC__) || defined(__clang__)
+        #define CLI_ATOMIC_LOAD(p)          __atomic_load_n( (p), __ATOMIC_SEQ_CST )
+        #define CLI_ATOMIC_STORE(p, v)      __atomic_store_n( (p), (v), __ATOMIC_SEQ_CST )
+        #define CLI_ATOMIC_ADD(p, v)        __atomic_add_fetch( (p), (v), __ATOMIC_SEQ_CST )
+    #elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+        #include <stdatomic.h>
+        #define CLI_ATOMIC                  _Atomic
+        #define CLI_ATOMIC_LOAD(p)          atomic_load( p )
+        #define CLI_ATOMIC_STORE(p, v)      atomic_store( (p), (v) )
+        #define CLI_ATOMIC_ADD(p, v)        atomic_fetch_add( (p), (v) )
+    #else
+        #error "No atomics for this compiler: define CLI_ATOMIC_LOAD, CLI_ATOMIC_STORE and CLI_ATOMIC_ADD (see AJScliCfg.h.example)"
+    #endif
+#endif // CLI_ATOMIC_LOAD
+
+// Qualifier for the variables those macros access
+#ifndef CLI_ATOMIC
+    #define CLI_ATOMIC
+#endif
+
 static char commandHistory[CLI_MAX_COMMAND_HISTORY + 1][CLI_MAX_COMMAND_LENGTH];
 static char currentCommand[CLI_MAX_COMMAND_LENGTH];
 static char printfBuf[CLI_PRINTF_BUF];
@@ -32,10 +57,15 @@ static int currentCursorPosition = 0;
 
 static CliGetCharFn_t getCharFn = NULL;
 static CliPutCharFn_t putCharFn = NULL;
+static CliWriteFn_t writeFn = NULL;
 static CliCtrlCFn_t ctrlCFn = NULL;
 static void *ctrlCArgs = NULL;
+static CliTickFn_t tickFn = NULL;
+static CliSink_t *activeSink = NULL;
 
-static CliCommandList_t commandLists[CLI_MAX_COMMAND_LISTS];
+// Lists are published by pointer so lookups never see a half written slot
+static CliCommandList_t listStore[CLI_MAX_COMMAND_LISTS][2];
+static CliCommandList_t * CLI_ATOMIC commandLists[CLI_MAX_COMMAND_LISTS];  // NULL if free
 
 static CliType_t prvCommandHelp(int argc, char *argv[]);
 static CliType_t prvCommandHistory(int argc, char *argv[]);
@@ -43,32 +73,123 @@ static CliType_t prvClearScreen(int argc, char *argv[]);
 #ifdef NVIC_SystemReset
 static CliType_t prvResetSystem(int argc, char *argv[]);
 #endif
+#if CLI_HAS_TRACE
+static CliType_t prvCommandTrace(int argc, char *argv[]);
+#endif
+#if CLI_HAS_REPEAT
+static CliType_t prvCommandRepeat(int argc, char *argv[]);
+#endif
+#if CLI_HAS_BINARY_LOG
+static CliType_t prvCommandLog(int argc, char *argv[]);
+#endif
+#if CLI_HAS_MEMORY_CMDS
+static CliType_t prvCommandMemDump(int argc, char *argv[]);
+static CliType_t prvCommandMemWrite(int argc, char *argv[]);
+#endif
+#if CLI_HAS_COMPRESS
+static CliType_t prvCommandCompress(int argc, char *argv[]);
+#endif
+#if CLI_HAS_MEM_REPORT
+static CliType_t prvCommandMemReport(int argc, char *argv[]);
+#endif
+#if CLI_HAS_XFER
+static CliType_t prvCommandRx(int argc, char *argv[]);
+static CliType_t prvCommandTx(int argc, char *argv[]);
+#endif
 
 static CliCommand_t defaultCommands[] = {
     {   .command    = "help",
-        .usage      = "<command>",
-        .help       = "Run help without <command> to see available commands\r\n    Use <command> to get detailed help on a specific command",
+        .usage      = CLI_TEXT(AJS_HELP_USAGE, "<command>"),
+        .help       = CLI_TEXT(AJS_HELP_HELP, "Run help without <command> to see available commands\r\n    Use <command> to get detailed help on a specific command"),
         .fn         = &prvCommandHelp,
     },
     {   .command    = "history",
         .usage      = "",
-        .help       = "Show command history",
+        .help       = CLI_TEXT(AJS_HISTORY_HELP, "Show command history"),
         .fn         = &prvCommandHistory,
     },
     {
         .command    = "cls",
         .usage      = "",
-        .help       = "Clear screen",
+        .help       = CLI_TEXT(AJS_CLS_HELP, "Clear screen"),
         .fn         = &prvClearScreen,
     },
 #ifdef NVIC_SystemReset
     {
         .command    = "reset",
         .usage      = "",
-        .help       = "Reset microcontroller",
+        .help       = CLI_TEXT(AJS_RESET_HELP, "Reset microcontroller"),
         .fn         = &prvResetSystem,
     },
 #endif
+#if CLI_HAS_REPEAT
+    {
+        .command    = "repeat",
+        .usage      = CLI_TEXT(AJS_REPEAT_USAGE, "<count> [-d <ms>] <command>"),
+        .help       = CLI_TEXT(AJS_REPEAT_HELP, "Run <command> <count> times on target and report elapsed time"),
+        .fn         = &prvCommandRepeat,
+    },
+#endif
+#if CLI_HAS_BINARY_LOG
+    {
+        .command    = "log",
+        .usage      = CLI_TEXT(AJS_LOG_USAGE, "[level]"),
+        .help       = CLI_TEXT(AJS_LOG_HELP, "Show or set binary log level (0 trace - 5 none)"),
+        .fn         = &prvCommandLog,
+    },
+#endif
+#if CLI_HAS_MEMORY_CMDS
+    {
+        .command    = "md",
+        .usage      = CLI_TEXT(AJS_MD_USAGE, "<addr> [bytes] [-w 1|2|4] [-b]"),
+        .help       = CLI_TEXT(AJS_MD_HELP, "Dump memory in hex/ASCII using 1, 2 or 4 byte reads\r\n    -b sends the raw bytes instead"),
+        .fn         = &prvCommandMemDump,
+    },
+    {
+        .command    = "mw",
+        .usage      = CLI_TEXT(AJS_MW_USAGE, "<addr> <value> [count] [-w 1|2|4]"),
+        .help       = CLI_TEXT(AJS_MW_HELP, "Write <value> to <count> 1, 2 or 4 byte locations"),
+        .fn         = &prvCommandMemWrite,
+    },
+#endif
+#if CLI_HAS_COMPRESS
+    {
+        .command    = "compress",
+        .usage      = CLI_TEXT(AJS_COMPRESS_USAGE, "[on|off]"),
+        .help       = CLI_TEXT(AJS_COMPRESS_HELP, "Compress output for tools/clizip, or show statistics"),
+        .fn         = &prvCommandCompress,
+    },
+#endif
+#if CLI_HAS_MEM_REPORT
+    {
+        .command    = "mem",
+        .usage      = "",
+        .help       = CLI_TEXT(AJS_MEM_HELP, "Show CLI buffer sizes and stack high-water marks"),
+        .fn         = &prvCommandMemReport,
+    },
+#endif
+#if CLI_HAS_XFER
+    {
+        .command    = "rx",
+        .usage      = "",
+        .help       = CLI_TEXT(AJS_RX_HELP, "Receive files with YMODEM (e.g. sb -k <file>)"),
+        .fn         = &prvCommandRx,
+    },
+    {
+        .command    = "tx",
+        .usage      = CLI_TEXT(AJS_TX_USAGE, "<file>"),
+        .help       = CLI_TEXT(AJS_TX_HELP, "Send <file> with YMODEM (e.g. rb)"),
+        .fn         = &prvCommandTx,
+    },
+#endif
+#if CLI_HAS_TRACE
+    {
+        .command    = "trace",
+        .usage      = CLI_TEXT(AJS_TRACE_USAGE, "[clear]"),
+        .help       = CLI_TEXT(AJS_TRACE_HELP, "Dump event trace in binary (decode with tools/clitrace)"),
+        .fn         = &prvCommandTrace,
+    },
+#endif
 };
 
 static int historyCommand;
@@ -76,8 +197,16 @@ static int currentCommandIdx;
 static struct Flags_s {
     unsigned screenCleared   : 1;
     unsigned insertMode      : 1;
+    unsigned pasting         : 1;
 } flags = {0};
 
+#if CLI_HAS_TRACE
+static unsigned int traceOut;
+#define CLI_TRACE_COUNT_OUT(n)          (traceOut += (n))
+#else
+#define CLI_TRACE_COUNT_OUT(n)
+#endif
+
 // Repeatable call for Ctrl-C, if registered
 static void prvCallCtrlC( void )
 {
@@ -86,6 +215,86 @@ static void prvCallCtrlC( void )
     }
 }
 
+// Current tick count, or 0 if no tick source was registered
+static unsigned long prvGetTick( void )
+{
+    return ( tickFn != NULL )? tickFn() : 0;
+}
+
+/* ===== Session Recording ===== */
+#if CLI_HAS_RECORD
+static CliRecordFn_t recordFn = NULL;
+static void *recordCtx = NULL;
+static unsigned char recordOut[CLI_RECORD_BUF];
+static int recordOutLen = 0;
+static unsigned long recordTick = 0;    // Time of the last record
+static unsigned long recordOutTick = 0; // Time the pending output started
+
+static int prvRecordVarint( unsigned char *p, unsigned long v )
+{
+    int n = 0;
+    do {
+        p[n++] = (unsigned char) ((v & 0x7F) | ((v > 0x7F)? 0x80 : 0));
+        v >>= 7;
+    } while ( v != 0 );
+    return n;
+}
+
+// Type, time since the last record and, for output, the length
+static void prvRecordHeader( int type, unsigned long tick, int len )
+{
+    unsigned char head[1 + 5 + 5];
+    int n = 0;
+
+    head[n++] = (unsigned char) type;
+    n += prvRecordVarint( &head[n], tick - recordTick );
+    if ( type == CLI_RECORD_EV_OUT ) {
+        n += prvRecordVarint( &head[n], (unsigned long) len );
+    }
+    recordTick = tick;
+    recordFn( recordCtx, head, n );
+}
+
+static void prvRecordFlush( void )
+{
+    if ( recordFn == NULL || recordOutLen == 0 ) return;
+    prvRecordHeader( CLI_RECORD_EV_OUT, recordOutTick, recordOutLen );
+    recordFn( recordCtx, recordOut, recordOutLen );
+    recordOutLen = 0;
+}
+
+static void prvRecordInput( int c )
+{
+    if ( recordFn == NULL ) return;
+    prvRecordFlush();
+    unsigned char byte = (unsigned char) c;
+    prvRecordHeader( CLI_RECORD_EV_IN, prvGetTick(), 0 );
+    recordFn( recordCtx, &byte, 1 );
+}
+
+static void prvRecordOutput( const char *data, int len )
+{
+    if ( recordFn == NULL ) return;
+    while ( len > 0 ) {
+        if ( recordOutLen == 0 ) recordOutTick = prvGetTick();
+        int n = CLI_RECORD_BUF - recordOutLen;
+        if ( n > len ) n = len;
+        memcpy( &recordOut[recordOutLen], data, n );
+        recordOutLen += n;
+        data += n;
+        len -= n;
+        if ( recordOutLen == CLI_RECORD_BUF ) prvRecordFlush();
+    }
+}
+    #define CLI_RECORD_IN(c)            prvRecordInput( c )
+    #define CLI_RECORD_OUT(data, len)   prvRecordOutput( data, len )
+    #define CLI_RECORD_FLUSH()          prvRecordFlush()
+#else
+    #define CLI_RECORD_IN(c)
+    #define CLI_RECORD_OUT(data, len)
+    #define CLI_RECORD_FLUSH()
+#endif // CLI_HAS_RECORD
+
 // Wrapper for getChar that checks for NULL
 static int prvGetChar( void )
 {
@@ -94,34 +303,539 @@ static int prvGetChar( void )
         prvCallCtrlC();
     }
 
-    return getCharFn();
+    int c = getCharFn();
+    if ( c >= 0 ) {
+        CLI_RECORD_IN( c );
+    }
+    return c;
 }
 
 // Wrapper for putChar that checks for NULL
-static void prvPutChar( char c )
+static void prvTransportPut( char c )
 {
     if ( putCharFn == NULL ) {
         printf( "FATAL: putChar occurred with NULL pointer!\r\n" );
         prvCallCtrlC();
     }
     else {
+        CLI_TRACE_COUNT_OUT( 1 );
         putCharFn(c);
     }
 }
 
-// Get a command based on the strings we know of
-static CliCommand_t *prvGetCommand( char *command )
+// Append output to a caller's sink
+static void prvSinkWrite( CliSink_t *sink, const char *data, int len )
+{
+    if ( sink->buf != NULL && sink->size > 0 ) {
+        // A reused sink may come back full or with a bad len
+        if ( sink->len < 0 || sink->len > sink->size - 1 ) sink->len = sink->size - 1;
+        int room = sink->size - 1 - sink->len;
+        int n = (len < room)? len : room;
+        memcpy( sink->buf + sink->len, data, n );
+        sink->len += n;
+        sink->buf[sink->len] = CLI_CHAR_NULL;
+        sink->dropped += len - n;
+    }
+    if ( sink->fn != NULL ) {
+        sink->fn( sink->ctx, data, len );
+    }
+}
+
+// Raw bytes to the transport, in bulk when possible
+static void prvTransportWrite( const char *data, int len )
+{
+    CLI_OUT_LOCK();
+    CLI_RECORD_OUT( data, len );
+    if ( writeFn != NULL ) {
+        CLI_TRACE_COUNT_OUT( len );
+        writeFn( data, len );
+    }
+    else {
+        while ( len-- > 0 ) {
+            prvTransportPut( *(data++) );
+        }
+    }
+    CLI_OUT_UNLOCK();
+}
+
+/* ===== Output Compression ===== */
+#if CLI_HAS_COMPRESS
+static unsigned char zipData[CLI_ZIP_WINDOW + CLI_COMPRESS_BUF];  // History, then pending output
+static unsigned char zipFrame[4 + CLI_COMPRESS_BUF + (CLI_COMPRESS_BUF + 7) / 8];
+static int zipPending = 0;
+static int zipHistory = 0;
+static unsigned char zipOn = CLI_FALSE;
+static unsigned long zipIn = 0;
+static unsigned long zipOut = 0;
+
+// Longest earlier match for zipData[pos..end), returns its length and distance
+static int prvZipMatch( int pos, int end, int *distance )
+{
+    int best = 0, j, len;
+    int first = pos - CLI_ZIP_WINDOW;
+
+    if ( first < CLI_ZIP_WINDOW - zipHistory ) first = CLI_ZIP_WINDOW - zipHistory;
+    for ( j = pos - 1; j >= first; j-- ) {
+        if ( zipData[j] != zipData[pos] ) continue;
+        for ( len = 1; pos + len < end && len < CLI_ZIP_MATCH_MAX && zipData[j + len] == zipData[pos + len]; len++ );
+        if ( len > best ) {
+            best = len;
+            *distance = pos - j;
+            if ( len == CLI_ZIP_MATCH_MAX ) break;
+        }
+    }
+    return best;
+}
+
+// Compress pending output into one frame and send it
+static void prvZipFlush( void )
+{
+    int pos = CLI_ZIP_WINDOW, end = CLI_ZIP_WINDOW + zipPending;
+    int out = 4, flagAt = 0, item = 8, distance = 0;
+
+    if ( zipPending == 0 ) return;
+    while ( pos < end ) {
+        if ( item == 8 ) {
+            flagAt = out++;
+            zipFrame[flagAt] = 0;
+            item = 0;
+        }
+        int len = prvZipMatch( pos, end, &distance );
+        if ( len >= CLI_ZIP_MATCH_MIN ) {
+            zipFrame[flagAt] |= (unsigned char) (1 << item);
+            zipFrame[out++] = (unsigned char) (distance - 1);
+            zipFrame[out++] = (unsigned char) (len - CLI_ZIP_MATCH_MIN);
+            pos += len;
+        }
+        else {
+            zipFrame[out++] = zipData[pos++];
+        }
+        ++item;
+    }
+
+    // Short echoes do not shrink, send those as they are unless they could look like a frame
+    if ( out >= zipPending && memchr( zipData + CLI_ZIP_WINDOW, CLI_ZIP_FRAME_START, zipPending ) == NULL ) {
+        prvTransportWrite( (const char *) zipData + CLI_ZIP_WINDOW, zipPending );
+        out = zipPending;
+    }
+    else {
+        zipFrame[0] = CLI_ZIP_FRAME_START;
+        zipFrame[1] = CLI_ZIP_FRAME_TYPE;
+        zipFrame[2] = (unsigned char) (out - 4);
+        zipFrame[3] = (unsigned char) ((out - 4) >> 8);
+        prvTransportWrite( (const char *) zipFrame, out );
+    }
+    zipIn += zipPending;
+    zipOut += out;
+
+    // Keep the last window of output as history for the next frame
+    memmove( zipData, zipData + zipPending, CLI_ZIP_WINDOW );
+    zipHistory = (zipHistory + zipPending > CLI_ZIP_WINDOW)? CLI_ZIP_WINDOW : zipHistory + zipPending;
+    zipPending = 0;
+}
+
+static void prvZipWrite( const char *data, int len )
+{
+    while ( len > 0 ) {
+        int n = CLI_COMPRESS_BUF - zipPending;
+        if ( n > len ) n = len;
+        memcpy( zipData + CLI_ZIP_WINDOW + zipPending, data, n );
+        zipPending += n;
+        data += n;
+        len -= n;
+        if ( zipPending == CLI_COMPRESS_BUF ) {
+            prvZipFlush();
+        }
+    }
+}
+
+// Negotiated by the host; the empty frame tells it compression is supported
+static CliType_t prvCommandCompress( int argc, char *argv[] )
+{
+    static const char ack[] = { CLI_ZIP_FRAME_START, CLI_ZIP_FRAME_TYPE, 0, 0 };
+
+    if ( argc == 1 ) {
+        cli_printf( "%scompress: %s, %lu bytes in, %lu out%s", CLI_NEWLINE, zipOn? "on" : "off", zipIn, zipOut, CLI_NEWLINE );
+    }
+    else if ( 0 == strncmp(argv[1], "on", CLI_MAX_COMMAND_LENGTH) ) {
+        prvZipFlush();
+        zipHistory = 0;
+        zipIn = zipOut = 0;
+        prvTransportWrite( ack, sizeof(ack) );
+        zipOn = CLI_TRUE;
+    }
+    else if ( 0 == strncmp(argv[1], "off", CLI_MAX_COMMAND_LENGTH) ) {
+        prvZipFlush();
+        zipOn = CLI_FALSE;
+    }
+    else {
+        return CLI_ERRNO_BAD_FMT;
+    }
+    return CLI_OK;
+}
+    #define CLI_ZIP_FLUSH()             prvZipFlush()
+#else
+    #define CLI_ZIP_FLUSH()
+#endif // CLI_HAS_COMPRESS
+
+// All output goes through here, to cli_execute's sink or the transport
+static void prvWrite( const char *data, int len )
+{
+    if ( activeSink != NULL ) {
+        prvSinkWrite( activeSink, data, len );
+        return;
+    }
+#if CLI_HAS_COMPRESS
+    if ( zipOn ) {
+        prvZipWrite( data, len );
+        return;
+    }
+#endif
+    prvTransportWrite( data, len );
+}
+
+static void prvPutChar( char c )
+{
+    prvWrite( &c, 1 );
+}
+
+/* ===== Scratch Arena ===== */
+#if CLI_HAS_SCRATCH
+static union {
+    unsigned char bytes[CLI_SCRATCH_SIZE];
+    long long alignLong;
+    double alignDouble;
+    void *alignPtr;
+} scratch;
+static unsigned int scratchUsed = 0;
+static unsigned int scratchHigh = 0;
+static unsigned int scratchDepth = 0;
+
+// Start of a handler call, returns the mark to release back to
+static unsigned int prvScratchEnter( void )
+{
+    ++scratchDepth;
+    return scratchUsed;
+}
+
+static void prvScratchLeave( unsigned int mark )
+{
+    --scratchDepth;
+    scratchUsed = mark;
+}
+    #define CLI_SCRATCH_ENTER()         unsigned int scratchMark = prvScratchEnter()
+    #define CLI_SCRATCH_LEAVE()         prvScratchLeave( scratchMark )
+#else
+    #define CLI_SCRATCH_ENTER()
+    #define CLI_SCRATCH_LEAVE()
+#endif // CLI_HAS_SCRATCH
+
+/* ===== Stack Usage =====
+ * cli_task paints CLI_STACK_PAINT_SIZE bytes below its frame. Before each
+ * command the area below the caller is painted again, and afterwards the
+ * lowest overwritten byte gives that command's depth. Only the outermost
+ * command running on cli_task's stack is measured (not cli_execute from
+ * other tasks). Assumes a stack that grows down.
+ */
+#if CLI_HAS_MEM_REPORT && CLI_STACK_PAINT_SIZE > 0
+#define CLI_STACK_PAINT_BYTE        (0xA5)
+#define CLI_STACK_GUARD             (128)   // Left alone below the painter's frame (x86-64 red zone)
+#define CLI_STACK_NAME_LEN          (12)
+
+#if defined(__GNUC__)
+    #define CLI_NOINLINE                __attribute__((noinline))
+#else
+    #define CLI_NOINLINE
+#endif
+
+typedef struct {
+    char name[CLI_STACK_NAME_LEN];
+    unsigned int bytes;
+} CliStackUse_t;
+
+static uintptr_t stackTop = 0;          // Just below cli_task's frame, 0 before cli_task runs
+static uintptr_t stackLow = 0;
+static uintptr_t stackDeepest = 0;      // Lowest byte found in use
+static unsigned int stackDepth = 0;
+static CliStackUse_t stackUse[CLI_STACK_CMDS];
+static unsigned int stackOther = 0;     // Deepest command that did not fit in stackUse
+
+static void prvStackPaint( uintptr_t end )
+{
+    volatile unsigned char *p = (volatile unsigned char *) stackLow;
+    while ( (uintptr_t) p < end ) {
+        *(p++) = CLI_STACK_PAINT_BYTE;
+    }
+}
+
+// Lowest byte that is no longer paint, also folded into the task high-water
+static uintptr_t prvStackScan( void )
+{
+    volatile unsigned char *p = (volatile unsigned char *) stackLow;
+    while ( (uintptr_t) p < stackTop && *p == CLI_STACK_PAINT_BYTE ) {
+        ++p;
+    }
+    if ( (uintptr_t) p < stackDeepest ) stackDeepest = (uintptr_t) p;
+    return (uintptr_t) p;
+}
+
+static CLI_NOINLINE void prvStackInit( void )
+{
+    volatile unsigned char here = 0;
+    stackTop = (uintptr_t) &here;
+    stackLow = stackTop - CLI_STACK_PAINT_SIZE;
+    stackDeepest = stackTop;
+    memset( stackUse, 0, sizeof(stackUse) );
+    prvStackPaint( stackTop - CLI_STACK_GUARD );
+}
+
+// Paint below the caller, returns where the callee's stack starts or 0 if not on cli_task's stack
+static CLI_NOINLINE uintptr_t prvStackMark( void )
+{
+    volatile unsigned char here = 0;
+    uintptr_t sp = (uintptr_t) &here;
+
+    if ( sp > stackTop || sp < stackLow + 2 * CLI_STACK_GUARD ) return 0;
+    prvStackScan();
+    prvStackPaint( sp - CLI_STACK_GUARD );
+    return sp;
+}
+
+static uintptr_t prvStackEnter( void )
+{
+    return ( stackDepth++ > 0 )? 0 : prvStackMark();
+}
+
+static void prvStackLeave( uintptr_t mark, const char *name )
+{
+    int i;
+    --stackDepth;
+    if ( mark == 0 ) return;
+
+    uintptr_t low = prvStackScan();
+    unsigned int used = ( low < mark )? (unsigned int) (mark - low) : 0;
+    for ( i = 0; i < CLI_STACK_CMDS; i++ ) {
+        if ( stackUse[i].name[0] == CLI_CHAR_NULL ) {
+            strncpy( stackUse[i].name, name, CLI_STACK_NAME_LEN - 1 );
+        }
+        if ( 0 == strncmp( stackUse[i].name, name, CLI_STACK_NAME_LEN - 1 ) ) {
+            if ( used > stackUse[i].bytes ) stackUse[i].bytes = used;
+            return;
+        }
+    }
+    if ( used > stackOther ) stackOther = used;
+}
+    #define CLI_STACK_INIT()            prvStackInit()
+    #define CLI_STACK_ENTER()           uintptr_t stackMark = prvStackEnter()
+    #define CLI_STACK_LEAVE(name)       prvStackLeave( stackMark, (name) )
+#else
+    #define CLI_STACK_INIT()
+    #define CLI_STACK_ENTER()
+    #define CLI_STACK_LEAVE(name)
+#endif // CLI_HAS_MEM_REPORT && CLI_STACK_PAINT_SIZE > 0
+
+/* ===== Event Trace ===== */
+#if CLI_HAS_TRACE
+typedef struct {
+    unsigned long tick;
+    unsigned char type;
+    unsigned char arg8;
+    unsigned short arg16;
+} CliTraceEvent_t;
+
+static CliTraceEvent_t traceRing[CLI_TRACE_DEPTH];
+static unsigned int traceHead = 0;
+static unsigned char tracePaused = CLI_FALSE;
+
+static void prvTrace( int type, int arg8, int arg16 )
+{
+    if ( tracePaused ) return;
+    CliTraceEvent_t *e = &traceRing[ (traceHead++) % CLI_TRACE_DEPTH ];
+    e->tick = prvGetTick();
+    e->type = (unsigned char) type;
+    e->arg8 = (unsigned char) arg8;
+    e->arg16 = (unsigned short) arg16;
+}
+
+// Record bytes handed to putChar since the last flush event
+static void prvTraceFlush( void )
+{
+    if ( traceOut > 0 ) {
+        prvTrace( CLI_TRACE_EV_FLUSH, 0, (traceOut > 0xFFFF)? 0xFFFF : traceOut );
+        traceOut = 0;
+    }
+}
+
+static void prvTracePut( unsigned long v, int bytes )
+{
+    while ( bytes-- ) {
+        prvPutChar( (char) (v & 0xFF) );
+        v >>= 8;
+    }
+}
+
+    #define CLI_TRACE(type, a8, a16)    prvTrace( (type), (a8), (a16) )
+    #define CLI_TRACE_COMMAND(slot, i)  prvTrace( CLI_TRACE_EV_DISPATCH, (slot), (i) )
+    #define CLI_TRACE_FLUSH()           prvTraceFlush()
+#else
+    #define CLI_TRACE(type, a8, a16)
+    #define CLI_TRACE_COMMAND(slot, i)
+    #define CLI_TRACE_FLUSH()
+#endif // CLI_HAS_TRACE
+
+#if CLI_HAS_REPEAT || defined(CLI_DELAY_MS) || (defined(INCLUDE_vTaskDelay) && INCLUDE_vTaskDelay)
+// Wait before polling again, lets lower priority tasks run under an RTOS
+static void prvDelayMs( unsigned long ms )
+{
+#if defined(CLI_DELAY_MS)
+    CLI_DELAY_MS( ms );
+#elif defined(INCLUDE_vTaskDelay) && INCLUDE_vTaskDelay
+    vTaskDelay( pdMS_TO_TICKS(ms) );
+#else
+    unsigned long start = prvGetTick();
+    while ( tickFn != NULL && (prvGetTick() - start) < CLI_MS_TO_TICKS(ms) );
+#endif
+}
+#endif
+
+/* ===== Command Lists =====
+ * Lookups may run in any task while another adds, removes or replaces a list.
+ * A reader registers under the current epoch in one of two counters, loads
+ * the slot pointers and stays registered until the command it found returns.
+ * A writer fills the slot's spare descriptor, publishes it, advances the
+ * epoch and waits until readers of the previous epoch are gone; after that
+ * no lookup, handler or string of the old list is in use.
+ * Readers never wait. Writers must not run concurrently with each other, and
+ * must not be called from a command handler (they would wait for themselves).
+ * A writer polls with CLI_DELAY_MS / vTaskDelay, else CLI_YIELD; without
+ * either it spins, so it must not preempt the reading task on a single core.
+ */
+static CLI_ATOMIC unsigned int listEpoch = 0;
+static CLI_ATOMIC unsigned int listReaders[2];
+
+static unsigned int prvListEnter( void )
+{
+    for ( ;; ) {
+        unsigned int epoch = CLI_ATOMIC_LOAD( &listEpoch );
+        CLI_ATOMIC_ADD( &listReaders[epoch & 1], 1 );
+        // A writer may have advanced the epoch before we were counted
+        if ( CLI_ATOMIC_LOAD( &listEpoch ) == epoch ) return epoch;
+        CLI_ATOMIC_ADD( &listReaders[epoch & 1], -1 );
+    }
+}
+
+static void prvListLeave( unsigned int epoch )
+{
+    CLI_ATOMIC_ADD( &listReaders[epoch & 1], -1 );
+}
+
+// Wait out every reader that may have loaded a slot before the last publish
+static void prvListSynchronize( void )
+{
+    unsigned int epoch = CLI_ATOMIC_LOAD( &listEpoch );
+    CLI_ATOMIC_STORE( &listEpoch, epoch + 1 );
+    while ( CLI_ATOMIC_LOAD( &listReaders[epoch & 1] ) != 0 ) {
+#if defined(CLI_DELAY_MS) || (defined(INCLUDE_vTaskDelay) && INCLUDE_vTaskDelay)
+        prvDelayMs( 1 );
+#elif defined(CLI_YIELD)
+        CLI_YIELD();
+#endif
+    }
+}
+
+/* Find a command, optionally reporting the slot and index it was found at.
+ * Call between prvListEnter and prvListLeave, and keep the section open
+ * while the command is used.
+ */
+static const CliCommand_t *prvGetCommand( const char *command, int *slot, int *index )
 {
+    const CliCommand_t *found = NULL;
     int i, j;
-    for ( i = 0; i < CLI_MAX_COMMAND_LISTS; i++ ) {
-        for ( j = 0; j < commandLists[i].count; j++ ) {
-            if ( 0 == strncmp(command, commandLists[i].commands[j].command, CLI_MAX_COMMAND_LENGTH) ) {
-                return &commandLists[i].commands[j];
+
+    for ( i = 0; i < CLI_MAX_COMMAND_LISTS && found == NULL; i++ ) {
+        const CliCommandList_t *list = CLI_ATOMIC_LOAD( &commandLists[i] );
+        if ( list == NULL ) continue;
+
+        if ( list->sorted ) {
+            // Binary search lists added with cli_addSortedList
+            int lo = 0, hi = list->count - 1;
+            while ( lo <= hi ) {
+                j = lo + (hi - lo) / 2;
+                int cmp = strncmp( command, list->commands[j].command, CLI_MAX_COMMAND_LENGTH );
+                if ( cmp == 0 ) {
+                    found = &list->commands[j];
+                    break;
+                }
+                if ( cmp < 0 ) hi = j - 1;
+                else lo = j + 1;
+            }
+            continue;
+        }
+        for ( j = 0; j < list->count; j++ ) {
+            if ( 0 == strncmp(command, list->commands[j].command, CLI_MAX_COMMAND_LENGTH) ) {
+                found = &list->commands[j];
+                break;
+            }
+        }
+    }
+    if ( found != NULL ) {
+        if ( slot != NULL ) *slot = i - 1;
+        if ( index != NULL ) *index = j;
+    }
+    return found;
+}
+
+#if CLI_HAS_PACKED_TEXT
+// Stream a packed string out of the text blob. References are CLI_CHAR_PACKED
+// followed by a 21 bit blob offset in three 7 bit bytes (high bit set so the
+// reference never contains a NULL). Blob bytes with the high bit set are
+// dictionary entries, everything else is a literal character.
+static void prvPrintPacked( const char *ref )
+{
+    const unsigned char *r = (const unsigned char *) ref;
+    const unsigned char *p = cliTextBlob +
+        ((r[1] & 0x7F) | ((r[2] & 0x7F) << 7) | ((unsigned long) (r[3] & 0x7F) << 14));
+    const unsigned char *entry, *end;
+    char chunk[CLI_PACKED_CHUNK];
+    int n = 0, idx;
+
+    for ( ; *p != CLI_CHAR_NULL; p++ ) {
+        if ( *p & 0x80 ) {
+            idx = 2 + 2 * (*p & 0x7F);
+            entry = cliTextBlob + (cliTextBlob[idx] | (cliTextBlob[idx + 1] << 8));
+            end = cliTextBlob + (cliTextBlob[idx + 2] | (cliTextBlob[idx + 3] << 8));
+        }
+        else {
+            entry = p;
+            end = p + 1;
+        }
+        while ( entry < end ) {
+            chunk[n++] = (char) *(entry++);
+            if ( n == CLI_PACKED_CHUNK ) {
+                prvWrite( chunk, n );
+                n = 0;
             }
         }
     }
+    if ( n > 0 ) {
+        prvWrite( chunk, n );
+    }
+}
+#endif // CLI_HAS_PACKED_TEXT
 
-    return NULL;
+// Print usage/help text, which may be packed
+static void prvPrintText( const char *text )
+{
+    if ( text == NULL ) return;
+#if CLI_HAS_PACKED_TEXT
+    if ( text[0] == CLI_CHAR_PACKED ) {
+        prvPrintPacked( text );
+        return;
+    }
+#endif
+    while ( *text != CLI_CHAR_NULL ) {
+        prvPutChar( *(text++) );
+    }
 }
 
 // Default command to print CLI help information
@@ -134,31 +848,35 @@ static CliType_t prvCommandHelp( int argc, char *argv[] )
         cli_printf( "%sCommand\t\tUsage%s===================================%s",
             CLI_NEWLINE, CLI_NEWLINE, CLI_NEWLINE );
         for ( i = 0; i < CLI_MAX_COMMAND_LISTS; i++ ) {
-            for ( j = 0; j < commandLists[i].count; j++ ) {
-                cli_printf("%s\t\t%s %s%s",
-                    commandLists[i].commands[j].command,
-                    commandLists[i].commands[j].command,
-                    commandLists[i].commands[j].usage,
-                    CLI_NEWLINE );
+            unsigned int epoch = prvListEnter();
+            const CliCommandList_t *list = CLI_ATOMIC_LOAD( &commandLists[i] );
+            for ( j = 0; list != NULL && j < list->count; j++ ) {
+                cli_printf("%s\t\t%s ",
+                    list->commands[j].command,
+                    list->commands[j].command );
+                prvPrintText( list->commands[j].usage );
+                cli_printf( CLI_NEWLINE );
             }
+            prvListLeave( epoch );
         }
     }
     else {
         // Requested help about specific command
-        CliCommand_t *cmd = prvGetCommand( argv[1] );
+        unsigned int epoch = prvListEnter();
+        const CliCommand_t *cmd = prvGetCommand( argv[1], NULL, NULL );
         if ( cmd == NULL ) {
+            prvListLeave( epoch );
             cli_printf_err( "Could not find \"%s\"%s", argv[1], CLI_NEWLINE );
             return CLI_ERRNO_UNKOWN_CMD;
         }
         else {
-            cli_printf( "%s%s %s%s    %s%s",
-                CLI_NEWLINE,
-                cmd->command,
-                cmd->usage,
-                CLI_NEWLINE,
-                cmd->help,
-                CLI_NEWLINE );
+            cli_printf( "%s%s ", CLI_NEWLINE, cmd->command );
+            prvPrintText( cmd->usage );
+            cli_printf( "%s    ", CLI_NEWLINE );
+            prvPrintText( cmd->help );
+            cli_printf( CLI_NEWLINE );
         }
+        prvListLeave( epoch );
     }
 
     return CLI_OK;
@@ -203,17 +921,104 @@ static CliType_t prvCommandHistory( int argc, char *argv[] )
     return CLI_OK;
 }
 
-// Find command within lists and call its function
-static void prvCallCommand( char *command )
+#if CLI_HAS_TRACE
+// Dump the trace ring oldest first as CLI_TRACE_MAGIC, version, tick rate, count,
+// 8 byte events, then the command names of every list for dispatch events
+static CliType_t prvCommandTrace( int argc, char *argv[] )
+{
+    unsigned int i, count, start;
+    int j;
+
+    if ( argc > 1 ) {
+        if ( 0 != strncmp(argv[1], "clear", CLI_MAX_COMMAND_LENGTH) ) return CLI_ERRNO_BAD_FMT;
+        traceHead = 0;
+        return CLI_OK;
+    }
+
+    tracePaused = CLI_TRUE;
+    count = (traceHead < CLI_TRACE_DEPTH)? traceHead : CLI_TRACE_DEPTH;
+    start = traceHead - count;
+
+    cli_printf( CLI_TRACE_MAGIC );
+    prvTracePut( CLI_TRACE_VERSION, 1 );
+    prvTracePut( CLI_TICKS_PER_SEC, 4 );
+    prvTracePut( count, 2 );
+    for ( i = 0; i < count; i++ ) {
+        CliTraceEvent_t *e = &traceRing[ (start + i) % CLI_TRACE_DEPTH ];
+        prvTracePut( e->tick, 4 );
+        prvTracePut( e->type, 1 );
+        prvTracePut( e->arg8, 1 );
+        prvTracePut( e->arg16, 2 );
+    }
+    for ( i = 0; i < CLI_MAX_COMMAND_LISTS; i++ ) {
+        unsigned int epoch = prvListEnter();
+        const CliCommandList_t *list = CLI_ATOMIC_LOAD( &commandLists[i] );
+        if ( list != NULL && list->count > 0 ) {
+            prvTracePut( i, 1 );
+            prvTracePut( list->count, 2 );
+            for ( j = 0; j < list->count; j++ ) {
+                cli_printf( "%s", list->commands[j].command );
+                prvPutChar( CLI_CHAR_NULL );
+            }
+        }
+        prvListLeave( epoch );
+    }
+    prvTracePut( 0xFF, 1 );
+    cli_printf( CLI_NEWLINE );
+    traceOut = 0;
+    tracePaused = CLI_FALSE;
+
+    return CLI_OK;
+}
+#endif // CLI_HAS_TRACE
+
+#if CLI_HAS_BINARY_LOG
+volatile int cliLogLevel = CLI_LOG_LEVEL_DEFAULT;
+
+// Keeps the format section (and __start_cli_fmt) present with no cli_log calls
+static const char cliLogSectionBase[] __attribute__((section(CLI_LOG_SECTION), used)) = "";
+
+static CliType_t prvCommandLog( int argc, char *argv[] )
+{
+    if ( argc > 1 ) {
+        char *end;
+        long level = strtol( argv[1], &end, 0 );
+        if ( *end != CLI_CHAR_NULL ) return CLI_ERRNO_BAD_FMT;
+        if ( level < CLI_LOG_LEVEL_TRACE || level > CLI_LOG_LEVEL_NONE ) return CLI_ERRNO_OUT_OF_RANGE;
+        cliLogLevel = (int) level;
+    }
+    cli_printf( "Log level %d (compiled minimum %d)%s", cliLogLevel, CLI_LOG_LEVEL_MIN, CLI_NEWLINE );
+    return CLI_OK;
+}
+
+// Append a varint, returns new length or -1 if it does not fit
+static int prvLogVarint( unsigned char *frame, int len, unsigned long long v )
+{
+    do {
+        if ( len >= CLI_LOG_FRAME_MAX ) return -1;
+        frame[len++] = (unsigned char) ((v & 0x7F) | ((v > 0x7F)? 0x80 : 0));
+        v >>= 7;
+    } while ( v != 0 );
+    return len;
+}
+#endif // CLI_HAS_BINARY_LOG
+
+// Find a single command within lists and call its function
+static CliType_t prvRunCommand( char *command )
 {
     // Terminate, if necessary
     int i = strnlen(command, CLI_MAX_COMMAND_LENGTH - 1);
     command[i] = CLI_CHAR_NULL;
 
-    // Remove any trailing spaces
-    while ( command[--i] == CLI_CHAR_SPACE ) {
+    // Remove any leading and trailing spaces
+    while ( *command == CLI_CHAR_SPACE ) {
+        ++command;
+        --i;
+    }
+    while ( i > 0 && command[--i] == CLI_CHAR_SPACE ) {
         command[i] = CLI_CHAR_NULL;
     }
+    if ( *command == CLI_CHAR_NULL ) return CLI_OK;
 
     char *argv[CLI_MAX_COMMAND_ARGS] = {0};
     int argc = 0;
@@ -234,93 +1039,1188 @@ static void prvCallCommand( char *command )
         }
     }
 
-    // Find Command
-    CliCommand_t *cmd = prvGetCommand( argv[0] );
+    // Find Command, its list stays in use until it returns
+    int slot, index;
+    unsigned int epoch = prvListEnter();
+    const CliCommand_t *cmd = prvGetCommand( argv[0], &slot, &index );
     if ( cmd == NULL ) {
+        prvListLeave( epoch );
         cli_printf_err( "Could not find \"%s\"%s", argv[0], CLI_NEWLINE );
-        return;
+        return CLI_ERRNO_UNKOWN_CMD;
     }
 
     // Execute Command
+    CLI_TRACE_COMMAND( slot, index );
+    CLI_SCRATCH_ENTER();
+    CLI_STACK_ENTER();
     int err = cmd->fn( argc, argv );
+    CLI_STACK_LEAVE( argv[0] );
+    CLI_SCRATCH_LEAVE();
+    CLI_TRACE( CLI_TRACE_EV_RETURN, 0, err );
     if ( err != CLI_OK ) {
         cli_printf_err("%sCommand \"%s\" returned error code: %d%s",
             CLI_NEWLINE,
             cmd->command,
             err, CLI_NEWLINE );
     }
+    prvListLeave( epoch );
+    return err;
 }
 
-// Quick macro for left arrow key press
-#define CLI_CURSOR_LEFT()   cli_printf( "%c%c%c", CLI_CHAR_ESCAPE, CLI_CHAR_ESC_PREFIX, CLI_CHAR_ARROW_LEFT )
-
-/* ===== Public Functions ===== */
-int cli_vprintf( const char *fmt, va_list ap ) {
-    int r = vsnprintf( printfBuf, CLI_PRINTF_BUF, fmt, ap );
-    printfBuf[CLI_PRINTF_BUF - 1] = CLI_CHAR_NULL;
+#if CLI_HAS_SEQUENCE
+/* Run a command line that may be split by sequencing operators (ex.)
+ * a ; b      - Run b after a
+ * a && b     - Run b only if a succeeded
+ * a || b     - Run b only if a failed
+ * A skipped command keeps the previous status, as in a shell.
+ */
+static CliType_t prvCallCommand( char *command )
+{
+    CliType_t status = CLI_OK;
+    char op = CLI_CHAR_SEQ_ALWAYS;
+    char *next;
+
+    while ( command != NULL ) {
+        // Find and cut off the next operator
+        for ( next = command; *next != CLI_CHAR_NULL; next++ ) {
+            if ( *next == CLI_CHAR_SEQ_ALWAYS ) break;
+            if ( (*next == CLI_CHAR_SEQ_AND || *next == CLI_CHAR_SEQ_OR) && next[1] == *next ) break;
+        }
+        char nextOp = *next;
+        if ( nextOp == CLI_CHAR_NULL ) {
+            next = NULL;
+        }
+        else {
+            *next = CLI_CHAR_NULL;
+            next += (nextOp == CLI_CHAR_SEQ_ALWAYS)? 1 : 2;
+        }
 
-    int i = 0;
-    while ( printfBuf[i] != CLI_CHAR_NULL ) {
-        prvPutChar( printfBuf[i++] );
+        if ( op == CLI_CHAR_SEQ_ALWAYS ||
+             (op == CLI_CHAR_SEQ_AND && status == CLI_OK) ||
+             (op == CLI_CHAR_SEQ_OR && status != CLI_OK) ) {
+            status = prvRunCommand( command );
+        }
+        op = nextOp;
+        command = next;
     }
 
-    return r;
+    return status;
 }
+#else
+    #define prvCallCommand(command)     prvRunCommand( command )
+#endif // CLI_HAS_SEQUENCE
 
-int cli_printf( const char *fmt, ... )
+#if CLI_HAS_REPEAT
+// Run a command N times on target, timed with the tick source
+static CliType_t prvCommandRepeat( int argc, char *argv[] )
 {
-    va_list ap;
+    char *end;
+    unsigned long delay = 0, i;
+    int first = 2, failed = 0;
+    CliType_t err, status = CLI_OK;
+
+    if ( argc < 3 ) return CLI_ERRNO_BAD_FMT;
+    unsigned long count = strtoul( argv[1], &end, 0 );
+    if ( *end != CLI_CHAR_NULL || count == 0 ) return CLI_ERRNO_BAD_FMT;
+
+    if ( 0 == strncmp(argv[2], "-d", CLI_MAX_COMMAND_LENGTH) ) {
+        if ( argc < 5 ) return CLI_ERRNO_BAD_FMT;
+        delay = strtoul( argv[3], &end, 0 );
+        if ( *end != CLI_CHAR_NULL ) return CLI_ERRNO_BAD_FMT;
+        first = 4;
+    }
+#if !defined(CLI_DELAY_MS) && !(defined(INCLUDE_vTaskDelay) && INCLUDE_vTaskDelay)
+    // prvDelayMs can only wait on the tick source here
+    if ( delay > 0 && tickFn == NULL ) {
+        cli_printf_err( "%sNo tick source for -d%s", CLI_NEWLINE, CLI_NEWLINE );
+        return CLI_ERRNO_NULL_PTR;
+    }
+#endif
+
+    unsigned int epoch = prvListEnter();
+    const CliCommand_t *cmd = prvGetCommand( argv[first], NULL, NULL );
+    if ( cmd == NULL ) {
+        prvListLeave( epoch );
+        cli_printf_err( "Could not find \"%s\"%s", argv[first], CLI_NEWLINE );
+        return CLI_ERRNO_UNKOWN_CMD;
+    }
+
+    unsigned long start = prvGetTick();
+    for ( i = 0; i < count; i++ ) {
+        if ( i > 0 && delay > 0 ) {
+            prvDelayMs( delay );
+        }
+        CLI_SCRATCH_ENTER();
+        err = cmd->fn( argc - first, argv + first );
+        CLI_SCRATCH_LEAVE();
+        if ( err != CLI_OK ) {
+            status = err;
+            ++failed;
+        }
+    }
+    unsigned long elapsed = prvGetTick() - start;
+    prvListLeave( epoch );
+
+    cli_printf( "%srepeat: %lu runs, %d failed", CLI_NEWLINE, count, failed );
+    if ( tickFn != NULL ) {
+        unsigned long long us = ((unsigned long long) elapsed * 1000000ULL) / CLI_TICKS_PER_SEC;
+        cli_printf( ", %llu us total, %llu us/run", us, us / count );
+    }
+    cli_printf( CLI_NEWLINE );
+
+    return status;
+}
+#endif // CLI_HAS_REPEAT
+
+#if CLI_HAS_MEMORY_CMDS
+static const char hexDigits[] = "0123456789abcdef";
+
+// Split md/mw arguments into numbers and the -w/-b options, returns count of numbers or -1
+static int prvMemArgs( int argc, char *argv[], uintptr_t *values, int max, int *width, int *raw )
+{
+    char *end;
+    int i, count = 0;
+
+    for ( i = 1; i < argc; i++ ) {
+        if ( 0 == strncmp(argv[i], "-w", CLI_MAX_COMMAND_LENGTH) && i + 1 < argc ) {
+            *width = (int) strtoul( argv[++i], &end, 0 );
+            if ( *end != CLI_CHAR_NULL || (*width != 1 && *width != 2 && *width != 4) ) return -1;
+        }
+        else if ( raw != NULL && 0 == strncmp(argv[i], "-b", CLI_MAX_COMMAND_LENGTH) ) {
+            *raw = 1;
+        }
+        else {
+            if ( count == max ) return -1;
+            values[count++] = (uintptr_t) strtoull( argv[i], &end, 0 );
+            if ( *end != CLI_CHAR_NULL ) return -1;
+        }
+    }
+    return count;
+}
+
+// Single read of the given width, copied out in memory order
+static uint32_t prvMemRead( uintptr_t addr, int width, unsigned char *out )
+{
+    uint32_t v;
+
+    if ( width == 4 ) {
+        v = *(volatile uint32_t *) addr;
+        memcpy( out, &v, 4 );
+    }
+    else if ( width == 2 ) {
+        uint16_t h = *(volatile uint16_t *) addr;
+        memcpy( out, &h, 2 );
+        v = h;
+    }
+    else {
+        v = *(volatile uint8_t *) addr;
+        *out = (unsigned char) v;
+    }
+    return v;
+}
+
+// Append a value as hex, most significant digit first
+static char *prvMemHex( char *p, unsigned long long v, int digits )
+{
+    while ( digits-- > 0 ) {
+        *(p++) = hexDigits[(v >> (digits * 4)) & 0xF];
+    }
+    return p;
+}
+
+// Dump memory one whole line per write instead of per character
+static CliType_t prvCommandMemDump( int argc, char *argv[] )
+{
+    uintptr_t values[2] = { 0, 64 };
+    int width = 4, raw = 0, i;
+    unsigned char bytes[CLI_MD_BYTES_PER_LINE];
+    char line[sizeof(uintptr_t) * 2 + 3 + CLI_MD_BYTES_PER_LINE * 4 + sizeof(CLI_NEWLINE) - 1];
+
+    int count = prvMemArgs( argc, argv, values, 2, &width, &raw );
+    if ( count < 1 ) return CLI_ERRNO_BAD_FMT;
+    uintptr_t addr = values[0], len = values[1];
+    if ( (addr % width) != 0 || (len % width) != 0 ) return CLI_ERRNO_BAD_FMT;
+
+    cli_printf( CLI_NEWLINE );
+    while ( len > 0 ) {
+        int n = (len < CLI_MD_BYTES_PER_LINE)? (int) len : CLI_MD_BYTES_PER_LINE;
+        char *p = prvMemHex( line, addr, sizeof(uintptr_t) * 2 );
+        *(p++) = ':';
+
+        for ( i = 0; i < n; i += width ) {
+            uint32_t v = prvMemRead( addr + i, width, &bytes[i] );
+            if ( !raw ) {
+                *(p++) = CLI_CHAR_SPACE;
+                p = prvMemHex( p, v, width * 2 );
+            }
+        }
+        if ( raw ) {
+            prvWrite( (const char *) bytes, n );
+        }
+        else {
+            // Pad a short last line so the ASCII column lines up
+            int pad = (CLI_MD_BYTES_PER_LINE - n) / width * (width * 2 + 1) + 2;
+            memset( p, CLI_CHAR_SPACE, pad );
+            p += pad;
+            for ( i = 0; i < n; i++ ) {
+                *(p++) = (bytes[i] >= CLI_CHAR_PRINT_MIN && bytes[i] <= CLI_CHAR_PRINT_MAX)? (char) bytes[i] : '.';
+            }
+            memcpy( p, CLI_NEWLINE, sizeof(CLI_NEWLINE) - 1 );
+            p += sizeof(CLI_NEWLINE) - 1;
+            prvWrite( line, (int) (p - line) );
+        }
+        addr += n;
+        len -= n;
+    }
+    return CLI_OK;
+}
+
+static CliType_t prvCommandMemWrite( int argc, char *argv[] )
+{
+    uintptr_t values[3] = { 0, 0, 1 }, i;
+    int width = 4;
+
+    int count = prvMemArgs( argc, argv, values, 3, &width, NULL );
+    if ( count < 2 ) return CLI_ERRNO_BAD_FMT;
+    uintptr_t addr = values[0];
+    if ( (addr % width) != 0 ) return CLI_ERRNO_BAD_FMT;
+
+    for ( i = 0; i < values[2]; i++, addr += width ) {
+        if ( width == 4 ) {
+            *(volatile uint32_t *) addr = (uint32_t) values[1];
+        }
+        else if ( width == 2 ) {
+            *(volatile uint16_t *) addr = (uint16_t) values[1];
+        }
+        else {
+            *(volatile uint8_t *) addr = (uint8_t) values[1];
+        }
+    }
+    return CLI_OK;
+}
+#endif // CLI_HAS_MEMORY_CMDS
+
+/* ===== File Transfer ===== */
+#if CLI_HAS_XFER
+static const CliXferOps_t *xferOps = NULL;
+static unsigned char xferBuf[3 + CLI_XFER_BLOCK + 2];   // Header, data, CRC
+
+// CRC-16/XMODEM, one nibble at a time
+static unsigned short prvXferCrc( const unsigned char *data, int len )
+{
+    static const unsigned short nibbles[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    };
+    unsigned short crc = 0;
+
+    while ( len-- > 0 ) {
+        crc = (unsigned short) ((crc << 4) ^ nibbles[((crc >> 12) ^ (*data >> 4)) & 0xF]);
+        crc = (unsigned short) ((crc << 4) ^ nibbles[((crc >> 12) ^ *(data++)) & 0xF]);
+    }
+    return crc;
+}
+
+// Next byte from the transport, or -1 after ms without one (a single poll without a tick source)
+static int prvXferGet( unsigned long ms )
+{
+    unsigned long start = prvGetTick();
+    int c;
+
+    do {
+        c = prvGetChar();
+        if ( c >= 0 ) return c & 0xFF;
+    } while ( tickFn != NULL && (prvGetTick() - start) < CLI_MS_TO_TICKS(ms) );
+    return -1;
+}
+
+// Timeouts need cli_setTickOp, otherwise a silent peer could never be given up on
+static int prvXferReady( void )
+{
+    if ( xferOps == NULL ) return CLI_FALSE;
+    if ( tickFn == NULL ) {
+        cli_printf_err( "%sNo tick source for transfer timeouts%s", CLI_NEWLINE, CLI_NEWLINE );
+        return CLI_FALSE;
+    }
+    return CLI_TRUE;
+}
+
+// Straight to the transport, never to a cli_execute sink or the compressor
+static void prvXferSend( const unsigned char *data, int len )
+{
+    CLI_ZIP_FLUSH();
+    prvTransportWrite( (const char *) data, len );
+}
+
+static void prvXferPut( unsigned char c )
+{
+    prvXferSend( &c, 1 );
+}
+
+// Drop input until the line goes quiet
+static void prvXferPurge( void )
+{
+    while ( prvXferGet( CLI_XFER_TIMEOUT_MS / 4 ) >= 0 );
+}
+
+static void prvXferCancel( void )
+{
+    static const unsigned char cancel[] = { CLI_XFER_CAN, CLI_XFER_CAN, CLI_XFER_CAN, CLI_XFER_CAN, CLI_XFER_CAN };
+    prvXferPurge();
+    prvXferSend( cancel, sizeof(cancel) );
+}
+
+// Receive one block into xferBuf. Returns its data length, 0 for EOT,
+// -1 for a timeout or bad block, -2 when the sender cancelled.
+static int prvXferRecvBlock( void )
+{
+    int c = prvXferGet( CLI_XFER_TIMEOUT_MS ), len, i;
+
+    if ( c == CLI_XFER_EOT ) return 0;
+    if ( c == CLI_XFER_CAN ) return ( prvXferGet(CLI_XFER_TIMEOUT_MS) == CLI_XFER_CAN )? -2 : -1;
+    if ( c == CLI_XFER_SOH ) len = CLI_XFER_BLOCK_SMALL;
+    else if ( c == CLI_XFER_STX ) len = CLI_XFER_BLOCK;
+    else return -1;
+
+    for ( i = 1; i < len + 5; i++ ) {
+        if ( (c = prvXferGet( CLI_XFER_TIMEOUT_MS )) < 0 ) return -1;
+        xferBuf[i] = (unsigned char) c;
+    }
+    if ( (xferBuf[1] ^ xferBuf[2]) != 0xFF ||
+         prvXferCrc( &xferBuf[3], len ) != ((xferBuf[len + 3] << 8) | xferBuf[len + 4]) ) {
+        return -1;
+    }
+    return len;
+}
+
+// Wait for the receiver to ask for a block; CAN CAN or silence gives up
+static CliType_t prvXferWaitFor( int want, int tries )
+{
+    int c, cans = 0;
+
+    while ( tries > 0 ) {
+        if ( (c = prvXferGet( CLI_XFER_TIMEOUT_MS )) < 0 ) {
+            --tries;
+        }
+        else if ( c == want ) {
+            return CLI_OK;
+        }
+        else if ( c == CLI_XFER_CAN && ++cans >= 2 ) {
+            return CLI_ERRNO_NO_RESPONSE;
+        }
+    }
+    return CLI_ERRNO_NO_RESPONSE;
+}
+
+// Frame xferBuf as block seq and send it until acknowledged
+static CliType_t prvXferSendBlock( unsigned char seq, int len )
+{
+    unsigned short crc = prvXferCrc( &xferBuf[3], len );
+    int tries;
+
+    xferBuf[0] = (len == CLI_XFER_BLOCK)? CLI_XFER_STX : CLI_XFER_SOH;
+    xferBuf[1] = seq;
+    xferBuf[2] = (unsigned char) ~seq;
+    xferBuf[len + 3] = (unsigned char) (crc >> 8);
+    xferBuf[len + 4] = (unsigned char) crc;
+
+    for ( tries = 0; tries < CLI_XFER_RETRIES; tries++ ) {
+        prvXferSend( xferBuf, len + 5 );
+        int c = prvXferGet( CLI_XFER_TIMEOUT_MS );
+        if ( c == CLI_XFER_ACK ) return CLI_OK;
+        if ( c == CLI_XFER_CAN && prvXferGet(CLI_XFER_TIMEOUT_MS) == CLI_XFER_CAN ) break;
+    }
+    return CLI_ERRNO_NO_RESPONSE;
+}
+
+// YMODEM batch receive, one block of RAM regardless of file size
+static CliType_t prvCommandRx( int argc, char *argv[] )
+{
+    CliType_t status = CLI_OK;
+    unsigned long size = 0, offset = 0, total = 0;
+    unsigned char expect = 0;
+    int len, tries = 0, eots = 0, files = 0, isOpen = CLI_FALSE;
+    (void) argc;
+    (void) argv;
+
+    if ( !prvXferReady() ) return CLI_ERRNO_NULL_PTR;
+    cli_printf( "%sStart YMODEM send...%s", CLI_NEWLINE, CLI_NEWLINE );
+
+    prvXferPut( CLI_XFER_CRC );
+    for ( ;; ) {
+        len = prvXferRecvBlock();
+        if ( len == -2 ) {
+            status = CLI_ERRNO_NO_RESPONSE;
+            break;
+        }
+        if ( len < 0 ) {
+            // Keep asking for the header while the user starts the sender
+            int waiting = ( !isOpen && files == 0 );
+            if ( ++tries > (waiting? CLI_XFER_START_TRIES : CLI_XFER_RETRIES) ) {
+                prvXferCancel();
+                status = CLI_ERRNO_NO_RESPONSE;
+                break;
+            }
+            prvXferPurge();
+            prvXferPut( isOpen? CLI_XFER_NAK : CLI_XFER_CRC );
+            continue;
+        }
+        tries = 0;
+
+        if ( len == 0 ) {
+            // NAK the first EOT to make sure it was not line noise
+            if ( isOpen && ++eots == 1 ) {
+                prvXferPut( CLI_XFER_NAK );
+                continue;
+            }
+            prvXferPut( CLI_XFER_ACK );
+            if ( isOpen ) {
+                xferOps->close( xferOps->ctx, CLI_OK );
+                isOpen = CLI_FALSE;
+                ++files;
+            }
+            eots = 0;
+            expect = 0;
+            prvXferPut( CLI_XFER_CRC );
+            continue;
+        }
+
+        if ( isOpen && xferBuf[1] == (unsigned char) (expect - 1) ) {
+            // Our ACK was lost, the sender repeated the last block
+            prvXferPut( CLI_XFER_ACK );
+            if ( expect == 1 ) prvXferPut( CLI_XFER_CRC );
+            continue;
+        }
+        if ( xferBuf[1] != expect ) {
+            prvXferCancel();
+            status = CLI_ERRNO_UNEXPECTED;
+            break;
+        }
+
+        if ( !isOpen ) {
+            // Block 0: "name\0size ..." or an empty name to end the batch
+            xferBuf[3 + len - 1] = CLI_CHAR_NULL;
+            const char *name = (const char *) &xferBuf[3];
+            if ( *name == CLI_CHAR_NULL ) {
+                prvXferPut( CLI_XFER_ACK );
+                break;
+            }
+            size = strtoul( name + strlen( name ) + 1, NULL, 10 );
+            if ( xferOps->open( xferOps->ctx, name, &size, CLI_TRUE ) != CLI_OK ) {
+                prvXferCancel();
+                status = CLI_ERRNO_FAULT;
+                break;
+            }
+            isOpen = CLI_TRUE;
+            offset = 0;
+            expect = 1;
+            prvXferPut( CLI_XFER_ACK );
+            prvXferPut( CLI_XFER_CRC );
+            continue;
+        }
+
+        // Trim the padding on the last block when the size is known
+        int n = len;
+        if ( size > 0 && (unsigned long) n > size - offset ) {
+            n = (int) (size - offset);
+        }
+        if ( n > 0 && xferOps->write( xferOps->ctx, offset, (const char *) &xferBuf[3], n ) != n ) {
+            prvXferCancel();
+            status = CLI_ERRNO_FAULT;
+            break;
+        }
+        offset += n;
+        total += n;
+        ++expect;
+        prvXferPut( CLI_XFER_ACK );
+    }
+
+    if ( isOpen ) {
+        xferOps->close( xferOps->ctx, status );
+    }
+    prvXferPurge();
+    cli_printf( "%srx: %d file(s), %lu bytes%s", CLI_NEWLINE, files, total, CLI_NEWLINE );
+    return status;
+}
+
+// YMODEM send of a single file
+static CliType_t prvCommandTx( int argc, char *argv[] )
+{
+    unsigned long size = 0, offset = 0;
+    unsigned char seq = 1;
+    CliType_t status;
+    int tries;
+
+    if ( argc != 2 ) return CLI_ERRNO_BAD_FMT;
+    if ( !prvXferReady() ) return CLI_ERRNO_NULL_PTR;
+    if ( xferOps->open( xferOps->ctx, argv[1], &size, CLI_FALSE ) != CLI_OK ) {
+        cli_printf_err( "Could not open \"%s\"%s", argv[1], CLI_NEWLINE );
+        return CLI_ERRNO_FAULT;
+    }
+    cli_printf( "%sStart YMODEM receive...%s", CLI_NEWLINE, CLI_NEWLINE );
+
+    // Header block with the name and decimal size
+    memset( &xferBuf[3], 0, CLI_XFER_BLOCK_SMALL );
+    snprintf( (char *) &xferBuf[3], CLI_XFER_BLOCK_SMALL, "%s%c%lu", argv[1], CLI_CHAR_NULL, size );
+    status = prvXferWaitFor( CLI_XFER_CRC, CLI_XFER_START_TRIES );
+    if ( status == CLI_OK ) status = prvXferSendBlock( 0, CLI_XFER_BLOCK_SMALL );
+    if ( status == CLI_OK ) status = prvXferWaitFor( CLI_XFER_CRC, CLI_XFER_RETRIES );
+
+    while ( status == CLI_OK && offset < size ) {
+        int want = (size - offset < CLI_XFER_BLOCK)? (int) (size - offset) : CLI_XFER_BLOCK;
+        int n = xferOps->read( xferOps->ctx, offset, (char *) &xferBuf[3], want );
+        if ( n <= 0 ) {
+            status = CLI_ERRNO_FAULT;
+            break;
+        }
+        int len = (n <= CLI_XFER_BLOCK_SMALL)? CLI_XFER_BLOCK_SMALL : CLI_XFER_BLOCK;
+        memset( &xferBuf[3 + n], CLI_XFER_PAD, len - n );
+        status = prvXferSendBlock( seq++, len );
+        offset += n;
+    }
+
+    if ( status == CLI_OK ) {
+        status = CLI_ERRNO_NO_RESPONSE;
+        for ( tries = 0; tries < CLI_XFER_RETRIES; tries++ ) {
+            prvXferPut( CLI_XFER_EOT );
+            if ( prvXferGet( CLI_XFER_TIMEOUT_MS ) == CLI_XFER_ACK ) {
+                status = CLI_OK;
+                break;
+            }
+        }
+    }
+
+    // An empty header closes the batch
+    if ( status == CLI_OK ) status = prvXferWaitFor( CLI_XFER_CRC, CLI_XFER_RETRIES );
+    if ( status == CLI_OK ) {
+        memset( &xferBuf[3], 0, CLI_XFER_BLOCK_SMALL );
+        status = prvXferSendBlock( 0, CLI_XFER_BLOCK_SMALL );
+    }
+    else {
+        prvXferCancel();
+    }
+
+    xferOps->close( xferOps->ctx, status );
+    prvXferPurge();
+    cli_printf( "%stx: %lu of %lu bytes%s", CLI_NEWLINE, offset, size, CLI_NEWLINE );
+    return status;
+}
+#endif // CLI_HAS_XFER
+
+/* ===== Memory Report ===== */
+#if CLI_HAS_MEM_REPORT
+static void prvMemLine( const char *name, unsigned long bytes, unsigned long *total )
+{
+    cli_printf( "  %-16s%8lu%s", name, bytes, CLI_NEWLINE );
+    if ( total != NULL ) *total += bytes;
+}
+
+#if CLI_STACK_PAINT_SIZE > 0
+// Format into printfBuf as cli_printf would, with a mix of conversions
+static CLI_NOINLINE int prvMemProbe( const char *fmt, ... )
+{
+    va_list ap;
+    va_start( ap, fmt );
+    int r = vsnprintf( printfBuf, CLI_PRINTF_BUF, fmt, ap );
+    va_end( ap );
+    return r;
+}
+#endif
+
+// Sizes come from the configuration; stack figures are high-water marks since cli_task started
+static CliType_t prvCommandMemReport( int argc, char *argv[] )
+{
+    unsigned long total = 0;
+    (void) argc;
+    (void) argv;
+
+    cli_printf( "%sStatic RAM%s", CLI_NEWLINE, CLI_NEWLINE );
+    prvMemLine( "history", sizeof(commandHistory), &total );
+    prvMemLine( "line", sizeof(currentCommand), &total );
+    prvMemLine( "printf", sizeof(printfBuf), &total );
+    prvMemLine( "lists", sizeof(listStore) + sizeof(commandLists), &total );
+    prvMemLine( "builtins", sizeof(defaultCommands), &total );
+#if CLI_HAS_TRACE
+    prvMemLine( "trace", sizeof(traceRing), &total );
+#endif
+#if CLI_HAS_RECORD
+    prvMemLine( "record", sizeof(recordOut), &total );
+#endif
+#if CLI_HAS_COMPRESS
+    prvMemLine( "compress", sizeof(zipData) + sizeof(zipFrame), &total );
+#endif
+#if CLI_HAS_SCRATCH
+    prvMemLine( "scratch", sizeof(scratch), &total );
+#endif
+#if CLI_HAS_XFER
+    prvMemLine( "xfer", sizeof(xferBuf), &total );
+#endif
+#if CLI_STACK_PAINT_SIZE > 0
+    prvMemLine( "stack use", sizeof(stackUse), &total );
+#endif
+    prvMemLine( "total", total, NULL );
+
+    cli_printf( "%sStack%s", CLI_NEWLINE, CLI_NEWLINE );
+    prvMemLine( "argv", sizeof(char *) * CLI_MAX_COMMAND_ARGS, NULL );
+#if CLI_HAS_SCRATCH
+    cli_printf( "  %-16s%8u of %u%s", "scratch used", scratchHigh, (unsigned int) CLI_SCRATCH_SIZE, CLI_NEWLINE );
+#endif
+#if CLI_STACK_PAINT_SIZE > 0
+    if ( stackTop == 0 ) {
+        cli_printf( "  cli_task not running, no stack marks%s", CLI_NEWLINE );
+        return CLI_OK;
+    }
+
+    // Measure a formatted print the way commands do, from here
+    uintptr_t mark = prvStackMark();
+    prvMemProbe( "%s %d %ld %lu %x %p %c %8.3f", "probe", -12345, -1234567L, 4000000000UL, 0xBEEFu, (void *) printfBuf, 'x', 3.14159 );
+    uintptr_t low = prvStackScan();
+    if ( mark != 0 ) {
+        prvMemLine( "vsnprintf", (low < mark)? mark - low : 0, NULL );
+    }
+
+    cli_printf( "  %-16s%8lu of %u%s", "cli_task", (unsigned long) (stackTop - stackDeepest),
+        (unsigned int) CLI_STACK_PAINT_SIZE, CLI_NEWLINE );
+    if ( stackDeepest <= stackLow ) {
+        cli_printf_err( "  Painted area exhausted, increase CLI_STACK_PAINT_SIZE%s", CLI_NEWLINE );
+    }
+    int i;
+    for ( i = 0; i < CLI_STACK_CMDS && stackUse[i].name[0] != CLI_CHAR_NULL; i++ ) {
+        prvMemLine( stackUse[i].name, stackUse[i].bytes, NULL );
+    }
+    if ( stackOther > 0 ) {
+        prvMemLine( "(others)", stackOther, NULL );
+    }
+#endif
+#if defined(INCLUDE_uxTaskGetStackHighWaterMark) && INCLUDE_uxTaskGetStackHighWaterMark
+    cli_printf( "  %-16s%8lu%s", "task free", (unsigned long) uxTaskGetStackHighWaterMark( NULL ) * sizeof(StackType_t), CLI_NEWLINE );
+#endif
+
+    return CLI_OK;
+}
+#endif // CLI_HAS_MEM_REPORT
+
+// Quick macro for left arrow key press
+#define CLI_CURSOR_LEFT()   cli_printf( "%c%c%c", CLI_CHAR_ESCAPE, CLI_CHAR_ESC_PREFIX, CLI_CHAR_ARROW_LEFT )
+
+/* ===== Message Limiting =====
+ * cli_printf_msg lines are batched: the prompt line is cleared before the
+ * first one and redrawn once when cli_task (or cli_msgFlush) flushes. Until
+ * getChar has returned with no input, cli_task may be blocked in it, so each
+ * message redraws the prompt itself. A
+ * message identical to the last one shown is only counted, and reported as
+ * "repeated N times" when another message is shown or CLI_MSG_REPEAT_MS
+ * passes. Each format string gets a token bucket of CLI_MSG_BURST refilled
+ * at CLI_MSG_RATE per second; messages without a token are counted and the
+ * count is shown with that format's next message.
+ */
+static const char lineClear[] = { CLI_CHAR_ESCAPE, CLI_CHAR_ESC_PREFIX, 'M', CLI_CHAR_RETURN };
+
+// Prompt and the line being edited, with the cursor back where it was
+static int prvRedrawLine( void )
+{
+    int i, r = cli_printf( "%s ", CLI_PROMPT );
+
+    for ( i = 0; i < currentCommandLength; i++ ) {
+        prvPutChar( currentCommand[i] );
+        ++r;
+    }
+    for ( i -= currentCursorPosition; i > 0; i-- ) {
+        r += CLI_CURSOR_LEFT();
+    }
+    return r;
+}
+
+#if CLI_HAS_MSG_LIMIT
+typedef struct {
+    const char *fmt;            // Identifies the call site, NULL if free
+    unsigned long tick;         // Last refill
+    unsigned int tokens;
+    unsigned long suppressed;
+} CliMsgSite_t;
+
+static CliMsgSite_t msgSites[CLI_MSG_SITES];
+static const char *msgLastFmt = NULL;   // Last message shown
+static unsigned long msgLastHash = 0;
+static unsigned long msgRepeats = 0;
+static unsigned long msgRepeatTick = 0;
+static unsigned char msgPending = CLI_FALSE;    // Prompt needs redrawing
+static unsigned char msgPolled = CLI_FALSE;     // getChar returns when idle
+
+// FNV-1a of the formatted message
+static unsigned long prvMsgHash( const char *text )
+{
+    unsigned long h = 2166136261UL;
+    while ( *text != CLI_CHAR_NULL ) {
+        h = ((h ^ (unsigned char) *(text++)) * 16777619UL) & 0xFFFFFFFFUL;
+    }
+    return h;
+}
+
+// Refill from elapsed time, then take a token if there is one
+static int prvMsgTake( CliMsgSite_t *site )
+{
+    unsigned long now = prvGetTick();
+    unsigned long long earned = ((unsigned long long) (now - site->tick) * CLI_MSG_RATE) / CLI_TICKS_PER_SEC;
+
+    if ( site->tokens + earned >= CLI_MSG_BURST ) {
+        site->tokens = CLI_MSG_BURST;
+        site->tick = now;
+    }
+    else if ( earned > 0 ) {
+        // Keep the remainder so slow refill rates are not rounded away
+        site->tokens += (unsigned int) earned;
+        site->tick += (unsigned long) ((earned * CLI_TICKS_PER_SEC) / CLI_MSG_RATE);
+    }
+    if ( site->tokens == 0 ) return CLI_FALSE;
+    --site->tokens;
+    return CLI_TRUE;
+}
+
+// Bucket for a format string; a site with nothing pending and a full bucket can be reused
+static CliMsgSite_t *prvMsgSite( const char *fmt )
+{
+    CliMsgSite_t *reuse = NULL;
+    unsigned long now = prvGetTick();
+    int i;
+
+    if ( tickFn == NULL ) return NULL;
+    for ( i = 0; i < CLI_MSG_SITES; i++ ) {
+        CliMsgSite_t *site = &msgSites[i];
+        if ( site->fmt == fmt ) return site;
+        if ( reuse == NULL && (site->fmt == NULL || (site->suppressed == 0 &&
+             (now - site->tick) >= CLI_MS_TO_TICKS( (1000UL * CLI_MSG_BURST) / CLI_MSG_RATE ))) ) {
+            reuse = site;
+        }
+    }
+    if ( reuse != NULL ) {
+        reuse->fmt = fmt;
+        reuse->tick = now;
+        reuse->tokens = CLI_MSG_BURST;
+        reuse->suppressed = 0;
+    }
+    return reuse;
+}
+
+// Write a fixed string without going through printfBuf, which may hold the message
+static int prvMsgPut( const char *s )
+{
+    int n = (int) strlen( s );
+    prvWrite( s, n );
+    return n;
+}
+
+// Clear the prompt line before the first message of a batch
+static int prvMsgBegin( void )
+{
+    if ( msgPending ) return 0;
+    msgPending = CLI_TRUE;
+    prvWrite( lineClear, sizeof(lineClear) );
+    return sizeof(lineClear);
+}
+
+// Message text, wrapped in color and ended with a newline
+static int prvMsgLine( const char *text )
+{
+    int r = prvMsgBegin();
+#if CLI_HAS_COLOR_PRINT
+    r += prvMsgPut( CLI_COLOR_GREEN );
+#endif
+    r += prvMsgPut( text );
+#if CLI_HAS_COLOR_PRINT
+    r += prvMsgPut( CLI_COLOR_DEFAULT );
+#endif
+    return r + prvMsgPut( CLI_NEWLINE );
+}
+
+static int prvMsgNote( const char *fmt, ... )
+{
+    char note[80];
+    va_list ap;
+    va_start( ap, fmt );
+    vsnprintf( note, sizeof(note), fmt, ap );
+    va_end( ap );
+    return prvMsgLine( note );
+}
+
+static int prvMsgRepeats( void )
+{
+    if ( msgRepeats == 0 ) return 0;
+    unsigned long n = msgRepeats;
+    msgRepeats = 0;
+    return prvMsgNote( "(last message repeated %lu times)", n );
+}
+
+static int prvMsgSuppressed( CliMsgSite_t *site )
+{
+    if ( site == NULL || site->suppressed == 0 ) return 0;
+    unsigned long n = site->suppressed;
+    site->suppressed = 0;
+    return prvMsgNote( "(%lu suppressed: \"%.24s\")", n, site->fmt );
+}
+
+/* Decide whether a message is shown. The text is formatted into printfBuf
+ * to compare it with the last one; site is its bucket, NULL if unlimited.
+ */
+static int prvMsgAdmit( const char *fmt, va_list ap, CliMsgSite_t **site )
+{
+    vsnprintf( printfBuf, CLI_PRINTF_BUF, fmt, ap );
+    printfBuf[CLI_PRINTF_BUF - 1] = CLI_CHAR_NULL;
+    unsigned long hash = prvMsgHash( printfBuf );
+
+    if ( fmt == msgLastFmt && hash == msgLastHash ) {
+        if ( msgRepeats++ == 0 ) msgRepeatTick = prvGetTick();
+        return CLI_FALSE;
+    }
+    *site = prvMsgSite( fmt );
+    if ( *site != NULL && !prvMsgTake( *site ) ) {
+        ++(*site)->suppressed;
+        return CLI_FALSE;
+    }
+
+    prvMsgRepeats();
+    msgLastFmt = fmt;
+    msgLastHash = hash;
+    return CLI_TRUE;
+}
+
+// Report what is due and redraw the prompt if messages were shown
+static void prvMsgFlush( int force )
+{
+    int i;
+
+    if ( msgRepeats > 0 && (force ||
+         (tickFn != NULL && (prvGetTick() - msgRepeatTick) >= CLI_MS_TO_TICKS(CLI_MSG_REPEAT_MS))) ) {
+        prvMsgRepeats();
+    }
+    for ( i = 0; i < CLI_MSG_SITES; i++ ) {
+        if ( msgSites[i].suppressed > 0 && (force || prvMsgTake( &msgSites[i] )) ) {
+            prvMsgSuppressed( &msgSites[i] );
+        }
+    }
+    if ( !msgPending ) return;
+
+    msgPending = CLI_FALSE;
+    prvRedrawLine();
+}
+    #define CLI_MSG_FLUSH()             prvMsgFlush( CLI_FALSE )
+    #define CLI_MSG_IDLE()              (msgPolled = CLI_TRUE, prvMsgFlush( CLI_FALSE ))
+    #define CLI_MSG_PROMPTED()          (msgPending = CLI_FALSE)
+#else
+    #define CLI_MSG_FLUSH()
+    #define CLI_MSG_IDLE()
+    #define CLI_MSG_PROMPTED()
+#endif // CLI_HAS_MSG_LIMIT
+
+// Put the prompt line back. Batches leave it to cli_task's next flush
+static int prvLineRestore( void )
+{
+#if CLI_HAS_MSG_LIMIT
+    if ( !msgPolled ) prvMsgFlush( CLI_FALSE );
+    return 0;
+#else
+    return prvRedrawLine();
+#endif
+}
+
+/* ===== Public Functions ===== */
+int cli_vprintf( const char *fmt, va_list ap ) {
+    int r = vsnprintf( printfBuf, CLI_PRINTF_BUF, fmt, ap );
+    printfBuf[CLI_PRINTF_BUF - 1] = CLI_CHAR_NULL;
+
+    prvWrite( printfBuf, strnlen( printfBuf, CLI_PRINTF_BUF ) );
+
+    return r;
+}
+
+int cli_printf( const char *fmt, ... )
+{
+    va_list ap;
     va_start( ap, fmt );
     int r = cli_vprintf( fmt, ap );
     va_end(ap);
     return r;
 }
 
-int cli_printf_msg( const char *fmt, ... )
+static int prvPrintMsg( const char *fmt, va_list ap )
+{
+#if CLI_HAS_MSG_LIMIT
+    va_list again;
+    CliMsgSite_t *site = NULL;
+    va_copy( again, ap );
+    int shown = prvMsgAdmit( fmt, again, &site );
+    va_end( again );
+    if ( !shown ) return 0;
+
+    // printfBuf still holds the text prvMsgAdmit formatted
+    int r = prvMsgLine( printfBuf );
+    r += prvMsgSuppressed( site );
+#else
+    int r = sizeof(lineClear);
+    prvWrite( lineClear, sizeof(lineClear) );
+#if CLI_HAS_COLOR_PRINT
+    r += cli_printf( CLI_COLOR_GREEN );
+#endif
+
+    r += cli_vprintf( fmt, ap );
+
+#if CLI_HAS_COLOR_PRINT
+    r += cli_printf( CLI_COLOR_DEFAULT );
+#endif
+    r += cli_printf( CLI_NEWLINE );
+#endif // CLI_HAS_MSG_LIMIT
+    r += prvLineRestore();
+    CLI_TRACE( CLI_TRACE_EV_MSG, 0, r );
+    CLI_TRACE_FLUSH();
+    CLI_ZIP_FLUSH();
+    return r;
+}
+
+int cli_printf_msg( const char *fmt, ... )
+{
+    va_list ap;
+    CLI_LOCK();
+    va_start( ap, fmt );
+    int r = prvPrintMsg( fmt, ap );
+    va_end( ap );
+    CLI_UNLOCK();
+    return r;
+}
+
+#if CLI_HAS_MSG_LIMIT
+// Show pending repeat and suppressed counts now and redraw the prompt
+void cli_msgFlush( void )
+{
+    CLI_LOCK();
+    prvMsgFlush( CLI_TRUE );
+    CLI_ZIP_FLUSH();
+    CLI_UNLOCK();
+}
+#endif
+
+#if CLI_HAS_BINARY_LOG
+// Emit one log frame. Arguments that do not fit in CLI_LOG_FRAME_MAX are dropped.
+void cli_log_write( int level, const char *fmt, const CliLogArg_t *args, int count )
+{
+    // Header, then the frame body, so the whole frame goes out in one write
+    unsigned char buf[3 + CLI_LOG_FRAME_MAX];
+    unsigned char *frame = &buf[3];
+    unsigned long id = (unsigned long) (fmt - __start_cli_fmt);
+    int len = 0, i, j, n;
+
+    frame[len++] = (unsigned char) level;
+    for ( i = 0; i < 4; i++ ) {
+        frame[len++] = (unsigned char) (id >> (8 * i));
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        int start = len;
+        if ( len >= CLI_LOG_FRAME_MAX ) break;
+        frame[len++] = args[i].tag;
+        switch ( args[i].tag ) {
+        case CLI_LOG_TAG_INT:
+            // Zigzag so small negative numbers stay short
+            len = prvLogVarint( frame, len, ((unsigned long long) args[i].v.i << 1) ^ (unsigned long long) (args[i].v.i >> 63) );
+            break;
+        case CLI_LOG_TAG_UINT:
+        case CLI_LOG_TAG_POINTER:
+            len = prvLogVarint( frame, len, args[i].v.u );
+            break;
+        case CLI_LOG_TAG_DOUBLE:
+            if ( len + 8 > CLI_LOG_FRAME_MAX ) {
+                len = -1;
+                break;
+            }
+            {
+                unsigned long long bits;
+                memcpy( &bits, &args[i].v.f, sizeof(bits) );
+                for ( j = 0; j < 8; j++ ) {
+                    frame[len++] = (unsigned char) (bits >> (8 * j));
+                }
+            }
+            break;
+        case CLI_LOG_TAG_STRING:
+            n = ( args[i].v.s == NULL )? 0 : (int) strnlen( args[i].v.s, CLI_LOG_FRAME_MAX );
+            if ( n > CLI_LOG_FRAME_MAX - len - 1 ) n = CLI_LOG_FRAME_MAX - len - 1;
+            if ( n < 0 ) {
+                len = -1;
+                break;
+            }
+            frame[len++] = (unsigned char) n;
+            memcpy( &frame[len], args[i].v.s, n );
+            len += n;
+            break;
+        default:
+            len = -1;
+            break;
+        }
+        if ( len < 0 ) {
+            len = start;
+            break;
+        }
+    }
+
+    buf[0] = CLI_LOG_FRAME_START;
+    buf[1] = CLI_LOG_FRAME_TYPE;
+    buf[2] = (unsigned char) len;
+
+    /* Straight to the transport, so the caller never waits on a running
+     * command. Frames are not captured by cli_execute or compressed, and hosts
+     * pick them out of the text by CLI_LOG_FRAME_START.
+     */
+    prvTransportWrite( (const char *) buf, len + 3 );
+}
+
+void cli_setLogLevel( int level )
+{
+    cliLogLevel = level;
+}
+#endif // CLI_HAS_BINARY_LOG
+
+/* Run a command line as if typed, capturing its output in out (if not NULL).
+ * Output goes through one global redirect, so calls from other tasks need
+ * CLI_LOCK/CLI_UNLOCK; without them call from the CLI task or while it is idle.
+ * Lines that do not fit CLI_MAX_COMMAND_LENGTH are refused, not truncated.
+ */
+CliType_t cli_execute( const char *line, CliSink_t *out )
+{
+    char command[CLI_MAX_COMMAND_LENGTH];
+
+    if ( line == NULL ) return CLI_ERRNO_NULL_PTR;
+    int len = strnlen( line, CLI_MAX_COMMAND_LENGTH );
+    if ( len == CLI_MAX_COMMAND_LENGTH ) return CLI_ERRNO_OUT_OF_RANGE;
+    memcpy( command, line, len + 1 );
+
+    CLI_LOCK();
+    CliSink_t *prevSink = activeSink;
+    if ( out != NULL ) {
+        activeSink = out;
+    }
+    CliType_t status = prvCallCommand( command );
+    activeSink = prevSink;
+    CLI_UNLOCK();
+
+    return status;
+}
+
+#if CLI_HAS_SCRATCH
+// Temporary memory for the running command handler, released when it returns.
+// Returns NULL when exhausted or when called outside of a command.
+void *cli_scratch( unsigned int size )
+{
+    unsigned int start = (scratchUsed + CLI_SCRATCH_ALIGN - 1) & ~(unsigned int) (CLI_SCRATCH_ALIGN - 1);
+
+    if ( scratchDepth == 0 || size > CLI_SCRATCH_SIZE || start > CLI_SCRATCH_SIZE - size ) {
+        return NULL;
+    }
+    scratchUsed = start + size;
+    if ( scratchUsed > scratchHigh ) {
+        scratchHigh = scratchUsed;
+    }
+    return &scratch.bytes[start];
+}
+
+// Most scratch memory in use at once since boot
+unsigned int cli_scratchHighWater( void )
 {
-    int r = cli_printf( "%c%c%c%c", CLI_CHAR_ESCAPE, CLI_CHAR_ESC_PREFIX, 'M', CLI_CHAR_RETURN );
-#if CLI_HAS_COLOR_PRINT
-    r += cli_printf( CLI_COLOR_GREEN );
-#endif
+    return scratchHigh;
+}
+#endif // CLI_HAS_SCRATCH
 
-    va_list ap;
-    va_start( ap, fmt );
-    r += cli_vprintf( fmt, ap );
-    va_end(ap);
+// Publish a list (or NULL to free the slot) and wait until the previous one is unused
+static void prvPublishList( int slot, const CliCommand_t *list, int count, int sorted )
+{
+    CliCommandList_t *prev = commandLists[slot];
+    CliCommandList_t *next = NULL;
+    if ( list != NULL ) {
+        // The spare descriptor, unused since the last publish waited out its readers
+        next = &listStore[slot][ commandLists[slot] == &listStore[slot][0] ];
+        next->commands = list;
+        next->count = count;
+        next->sorted = sorted;
+    }
+    CLI_ATOMIC_STORE( &commandLists[slot], next );
 
-#if CLI_HAS_COLOR_PRINT
-    r += cli_printf( CLI_COLOR_DEFAULT );
-#endif
-    r += cli_printf( "%s%s ", CLI_NEWLINE, CLI_PROMPT );
+    // Filling a free slot replaces nothing, so cli_addList never waits
+    if ( prev != NULL ) prvListSynchronize();
+}
 
+// Slot holding list, or a free slot if list is NULL
+static int prvFindList( const CliCommand_t *list )
+{
     int i;
-    for ( i = 0; i < currentCommandLength; i++ ) {
-        prvPutChar( currentCommand[i] );
-        ++r;
+    for ( i = 0; i < CLI_MAX_COMMAND_LISTS; i++ ) {
+        const CliCommand_t *commands = ( commandLists[i] != NULL )? commandLists[i]->commands : NULL;
+        if ( commands == list ) return i;
     }
-    i -= currentCursorPosition;
+    return -1;
+}
 
-    while ( i-- ) {
-        r += CLI_CURSOR_LEFT();
+static int prvIsSorted( const CliCommand_t *list, int count )
+{
+    int i;
+    for ( i = 1; i < count; i++ ) {
+        if ( strncmp(list[i - 1].command, list[i].command, CLI_MAX_COMMAND_LENGTH) >= 0 ) {
+            return CLI_FALSE;
+        }
     }
-    return r;
+    return CLI_TRUE;
 }
 
 // Add a list of commands to our command list array
-CliType_t cli_addList( CliCommand_t *list, int count )
-{
-    int i = 0;
-    while ( i < CLI_MAX_COMMAND_LISTS ) {
-        // Find empty spot to add list
-        if ( commandLists[i].commands == NULL ) {
-            commandLists[i].commands = list;
-            commandLists[i].count = count;
-            return CLI_OK;
-        }
-        else ++i;
-    }
+static CliType_t prvAddList( const CliCommand_t *list, int count, int sorted )
+{
+    if ( list == NULL ) return CLI_ERRNO_NULL_PTR;
+
+    int i = prvFindList( NULL );
+    if ( i < 0 ) return CLI_ERRNO_NOMEM;
+
+    prvPublishList( i, list, count, sorted );
+    return CLI_OK;
+}
+
+CliType_t cli_addList( const CliCommand_t *list, int count )
+{
+    return prvAddList( list, count, CLI_FALSE );
+}
+
+// Add a list whose names are in strcmp order (ex. from AJScli.hpp) to be found by binary search
+CliType_t cli_addSortedList( const CliCommand_t *list, int count )
+{
+    if ( list != NULL && !prvIsSorted( list, count ) ) return CLI_ERRNO_BAD_FMT;
+    return prvAddList( list, count, CLI_TRUE );
+}
+
+/* Remove a list added before. Waits for commands of the list that are running;
+ * once this returns its table, strings and handlers are no longer in use (ex.
+ * a module may be unloaded). Not for use inside a command handler.
+ */
+CliType_t cli_removeList( const CliCommand_t *list )
+{
+    int i = ( list != NULL )? prvFindList( list ) : -1;
+    if ( i < 0 ) return CLI_ERRNO_UNKOWN_CMD;
+
+    prvPublishList( i, NULL, 0, CLI_FALSE );
+    return CLI_OK;
+}
 
-    return CLI_ERRNO_NOMEM;
+/* Swap a list for another in the same slot in one step, so a command is never
+ * missing in between (ex. production and service mode). A sorted list must be
+ * replaced by a sorted one. Waits as cli_removeList does, so not for use
+ * inside a command handler.
+ */
+CliType_t cli_replaceList( const CliCommand_t *old, const CliCommand_t *list, int count )
+{
+    if ( old == NULL || list == NULL ) return CLI_ERRNO_NULL_PTR;
+
+    int i = prvFindList( old );
+    if ( i < 0 ) return CLI_ERRNO_UNKOWN_CMD;
+
+    int sorted = commandLists[i]->sorted;
+    if ( sorted && !prvIsSorted( list, count ) ) return CLI_ERRNO_BAD_FMT;
+
+    prvPublishList( i, list, count, sorted );
+    return CLI_OK;
 }
 
 // Set operation to occur on Ctrl-C
@@ -330,6 +2230,45 @@ void cli_setCtrlCOp( CliCtrlCFn_t ctrlC, void *args )
     ctrlCArgs = args;
 }
 
+// Set free running tick source (CLI_TICKS_PER_SEC) used for timeouts
+void cli_setTickOp( CliTickFn_t tick )
+{
+    tickFn = tick;
+}
+
+// Set optional bulk output function, used instead of putChar for whole writes
+void cli_setWriteOp( CliWriteFn_t write )
+{
+    writeFn = write;
+}
+
+#if CLI_HAS_XFER
+// Set storage used by the rx/tx commands
+void cli_setXferOps( const CliXferOps_t *ops )
+{
+    xferOps = ops;
+}
+#endif
+
+#if CLI_HAS_RECORD
+// Record transport traffic to record(ctx, ...), NULL stops. Starts with a header.
+void cli_setRecordOp( CliRecordFn_t record, void *ctx )
+{
+    prvRecordFlush();
+    recordFn = record;
+    recordCtx = ctx;
+    if ( record != NULL ) {
+        unsigned char head[sizeof(CLI_RECORD_MAGIC) + 5];
+        int n = sizeof(CLI_RECORD_MAGIC) - 1;
+        memcpy( head, CLI_RECORD_MAGIC, n );
+        head[n++] = CLI_RECORD_VERSION;
+        n += prvRecordVarint( &head[n], CLI_TICKS_PER_SEC );
+        record( ctx, head, n );
+        recordTick = prvGetTick();
+    }
+}
+#endif
+
 #if CLI_SET_OPS
 // Set getChar and putChar functions for CLI
 CliType_t cli_setOps( CliGetCharFn_t getChar, CliPutCharFn_t putChar )
@@ -363,7 +2302,8 @@ CliType_t cli_init( void )
 
     flags.insertMode = 0;
     flags.screenCleared = 0;
-    memset( commandLists, 0, sizeof(commandLists) );
+    flags.pasting = 0;
+    memset( (void *) commandLists, 0, sizeof(commandLists) );
     int err = cli_addList( defaultCommands, (sizeof(defaultCommands) / sizeof(defaultCommands[0])) );
     if ( err != CLI_OK ) {
         printf( "Could not add CLI commands: %s:%d%s", __FILE__, __LINE__, CLI_NEWLINE );
@@ -371,6 +2311,493 @@ CliType_t cli_init( void )
     return err;
 }
 
+/* ===== Line Editor ===== */
+
+// Editor actions decoded from escape sequences / scan codes
+enum {
+    CLI_ACT_NONE = 0,
+    CLI_ACT_UP,
+    CLI_ACT_DOWN,
+    CLI_ACT_RIGHT,
+    CLI_ACT_LEFT,
+    CLI_ACT_HOME,
+    CLI_ACT_END,
+    CLI_ACT_INSERT,
+    CLI_ACT_DELETE,
+    CLI_ACT_WORD_RIGHT,
+    CLI_ACT_WORD_LEFT,
+    CLI_ACT_PASTE_BEGIN,
+    CLI_ACT_PASTE_END,
+    CLI_ACT_COUNT
+};
+
+// Escape decoder states
+enum {
+    CLI_ESC_GROUND = 0,
+    CLI_ESC_ESCAPE,
+    CLI_ESC_CSI,
+    CLI_ESC_SS3,
+    CLI_ESC_SCAN,
+};
+
+#define CLI_ESC_MAX_PARAMS          (2)
+#define CLI_ESC_PARAM_MAX           (0xFFFF)
+#define CLI_ESC_PASTE_BEGIN         (200)
+#define CLI_ESC_PASTE_END           (201)
+
+static struct EscDecoder_s {
+    unsigned char state;
+    unsigned char paramCount;
+    unsigned int params[CLI_ESC_MAX_PARAMS];
+    unsigned long start;
+    unsigned long pasteTick;    // Last byte of a bracketed paste
+} esc = {0};
+
+// Final byte of CSI sequences, indexed from '@'
+static const unsigned char escFinalActions[CLI_CHAR_ESC_FINAL_MAX - CLI_CHAR_ESC_FINAL_MIN + 1] = {
+    [CLI_CHAR_ARROW_UP - CLI_CHAR_ESC_FINAL_MIN]    = CLI_ACT_UP,
+    [CLI_CHAR_ARROW_DOWN - CLI_CHAR_ESC_FINAL_MIN]  = CLI_ACT_DOWN,
+    [CLI_CHAR_ARROW_RIGHT - CLI_CHAR_ESC_FINAL_MIN] = CLI_ACT_RIGHT,
+    [CLI_CHAR_ARROW_LEFT - CLI_CHAR_ESC_FINAL_MIN]  = CLI_ACT_LEFT,
+    [CLI_CHAR_HOME - CLI_CHAR_ESC_FINAL_MIN]        = CLI_ACT_HOME,
+    [CLI_CHAR_END - CLI_CHAR_ESC_FINAL_MIN]         = CLI_ACT_END,
+    [CLI_CHAR_INSERT - CLI_CHAR_ESC_FINAL_MIN]      = CLI_ACT_INSERT,
+    [CLI_CHAR_DELETE - CLI_CHAR_ESC_FINAL_MIN]      = CLI_ACT_DELETE,
+};
+
+// Final byte of SS3 sequences. 'ESC'OP..S are F1..F4, not insert/delete
+static const unsigned char escSs3Actions[CLI_CHAR_ESC_FINAL_MAX - CLI_CHAR_ESC_FINAL_MIN + 1] = {
+    [CLI_CHAR_ARROW_UP - CLI_CHAR_ESC_FINAL_MIN]    = CLI_ACT_UP,
+    [CLI_CHAR_ARROW_DOWN - CLI_CHAR_ESC_FINAL_MIN]  = CLI_ACT_DOWN,
+    [CLI_CHAR_ARROW_RIGHT - CLI_CHAR_ESC_FINAL_MIN] = CLI_ACT_RIGHT,
+    [CLI_CHAR_ARROW_LEFT - CLI_CHAR_ESC_FINAL_MIN]  = CLI_ACT_LEFT,
+    [CLI_CHAR_HOME - CLI_CHAR_ESC_FINAL_MIN]        = CLI_ACT_HOME,
+    [CLI_CHAR_END - CLI_CHAR_ESC_FINAL_MIN]         = CLI_ACT_END,
+};
+
+// VT220 style 'ESC[n~' keys, indexed by n
+static const unsigned char escTildeActions[] = {
+    [1] = CLI_ACT_HOME,
+    [2] = CLI_ACT_INSERT,
+    [3] = CLI_ACT_DELETE,
+    [4] = CLI_ACT_END,
+    [7] = CLI_ACT_HOME,
+    [8] = CLI_ACT_END,
+};
+
+#if CLI_GET_CH
+// Console scan codes following CLI_CHAR_SCAN_PREFIX
+static const unsigned char escScanActions[CLI_CHAR_PRINT_MAX + 1] = {
+    [CLI_CHAR_ARROW_UP_READ]    = CLI_ACT_UP,
+    [CLI_CHAR_ARROW_DOWN_READ]  = CLI_ACT_DOWN,
+    [CLI_CHAR_ARROW_RIGHT_READ] = CLI_ACT_RIGHT,
+    [CLI_CHAR_ARROW_LEFT_READ]  = CLI_ACT_LEFT,
+    ['G']                       = CLI_ACT_HOME,
+    ['O']                       = CLI_ACT_END,
+    [CLI_CHAR_INSERT_READ]      = CLI_ACT_INSERT,
+    [CLI_CHAR_DELETE_READ]      = CLI_ACT_DELETE,
+    ['t']                       = CLI_ACT_WORD_RIGHT,
+    ['s']                       = CLI_ACT_WORD_LEFT,
+};
+#endif // CLI_GET_CH
+
+// Move cursor to any position within the current command
+static void prvMoveCursor( int pos )
+{
+    if ( flags.insertMode ) {
+        // Clean up highlighted character
+        prvPutChar( (currentCursorPosition == currentCommandLength)? CLI_CHAR_SPACE : currentCommand[currentCursorPosition] );
+        CLI_CURSOR_LEFT();
+    }
+    if ( pos < currentCursorPosition ) {
+        cli_printf( "%c%c%d%c", CLI_CHAR_ESCAPE, CLI_CHAR_ESC_PREFIX, currentCursorPosition - pos, CLI_CHAR_ARROW_LEFT );
+        currentCursorPosition = pos;
+    }
+    while ( currentCursorPosition < pos ) {
+        prvPutChar( currentCommand[currentCursorPosition++] );
+    }
+}
+
+static void prvActHistory( int action )
+{
+    /* Up */
+    if ( action == CLI_ACT_UP && CLI_COMMAND_PREV(historyCommand) != currentCommandIdx ) {
+        if ( historyCommand == currentCommandIdx ) {
+            memcpy( commandHistory[currentCommandIdx], currentCommand, CLI_MAX_COMMAND_LENGTH );
+        }
+        if ( commandHistory[ CLI_COMMAND_PREV(historyCommand) ][0] == 0 ) {
+            prvPutChar( CLI_CHAR_BELL );
+        }
+        else {
+            historyCommand = CLI_COMMAND_PREV( historyCommand );
+        }
+    }
+    /* Down */
+    else if ( action == CLI_ACT_DOWN && historyCommand != currentCommandIdx ) {
+        if ( commandHistory[ CLI_COMMAND_NEXT(historyCommand) ][0] == 0 ) {
+            prvPutChar( CLI_CHAR_BELL );
+        }
+        else {
+            historyCommand = CLI_COMMAND_NEXT( historyCommand );
+        }
+    }
+
+    memcpy( currentCommand, commandHistory[historyCommand], CLI_MAX_COMMAND_LENGTH );
+    cli_printf( "%c%c%c%c%s %s", CLI_CHAR_ESCAPE, CLI_CHAR_ESC_PREFIX, 'M', CLI_CHAR_RETURN, CLI_PROMPT, currentCommand );
+    CLI_MSG_PROMPTED();
+    currentCursorPosition = strnlen( currentCommand, CLI_MAX_COMMAND_LENGTH );
+    currentCommandLength = currentCursorPosition;
+}
+
+static void prvActRight( int action )
+{
+    (void) action;
+    if ( currentCursorPosition < currentCommandLength ) {
+        prvPutChar( currentCommand[currentCursorPosition++] );
+    }
+}
+
+static void prvActLeft( int action )
+{
+    (void) action;
+    if ( currentCursorPosition != 0 ) {
+        if ( flags.insertMode ) {
+            prvPutChar( (currentCursorPosition == currentCommandLength)? CLI_CHAR_SPACE : currentCommand[currentCursorPosition] );
+            CLI_CURSOR_LEFT();
+        }
+        --currentCursorPosition;
+        CLI_CURSOR_LEFT();
+    }
+}
+
+static void prvActHomeEnd( int action )
+{
+    prvMoveCursor( (action == CLI_ACT_HOME)? 0 : currentCommandLength );
+}
+
+static void prvActWord( int action )
+{
+    int i = currentCursorPosition;
+    if ( action == CLI_ACT_WORD_LEFT ) {
+        while ( i > 0 && currentCommand[i - 1] == CLI_CHAR_SPACE ) --i;
+        while ( i > 0 && currentCommand[i - 1] != CLI_CHAR_SPACE ) --i;
+    }
+    else {
+        while ( i < currentCommandLength && currentCommand[i] != CLI_CHAR_SPACE ) ++i;
+        while ( i < currentCommandLength && currentCommand[i] == CLI_CHAR_SPACE ) ++i;
+    }
+    prvMoveCursor( i );
+}
+
+static void prvActInsert( int action )
+{
+    (void) action;
+#if CLI_HAS_INSERT_MODE
+    flags.insertMode = !flags.insertMode;
+    if ( !flags.insertMode ) {
+        // If leaving mode, clean up next character
+        prvPutChar( (currentCursorPosition == currentCommandLength)? CLI_CHAR_SPACE : currentCommand[ currentCursorPosition ] );
+        CLI_CURSOR_LEFT();
+    }
+#else
+    // We are ignoring this input
+    flags.insertMode = CLI_FALSE;
+#endif // CLI_HAS_INSERT_MODE
+}
+
+static void prvActDelete( int action )
+{
+    int i;
+    (void) action;
+    if ( currentCommandLength > 0 && currentCursorPosition < currentCommandLength ) {
+        for ( i = currentCursorPosition + 1; i < currentCommandLength; i++ ) {
+            prvPutChar( currentCommand[i] );
+        }
+        prvPutChar( CLI_CHAR_SPACE );
+        for ( i = 1; i <= currentCommandLength - currentCursorPosition; i++ ) {
+            // Move back to where we were
+            CLI_CURSOR_LEFT();
+        }
+        memmove( currentCommand + currentCursorPosition, currentCommand + currentCursorPosition + 1, (currentCommandLength - currentCursorPosition) + 1 );
+        currentCommand[ --currentCommandLength ] = 0;
+    }
+}
+
+static void prvActPaste( int action )
+{
+    flags.pasting = (action == CLI_ACT_PASTE_BEGIN);
+    esc.pasteTick = prvGetTick();
+}
+
+static void (* const editorActions[CLI_ACT_COUNT])( int action ) = {
+    [CLI_ACT_UP]            = &prvActHistory,
+    [CLI_ACT_DOWN]          = &prvActHistory,
+    [CLI_ACT_RIGHT]         = &prvActRight,
+    [CLI_ACT_LEFT]          = &prvActLeft,
+    [CLI_ACT_HOME]          = &prvActHomeEnd,
+    [CLI_ACT_END]           = &prvActHomeEnd,
+    [CLI_ACT_INSERT]        = &prvActInsert,
+    [CLI_ACT_DELETE]        = &prvActDelete,
+    [CLI_ACT_WORD_RIGHT]    = &prvActWord,
+    [CLI_ACT_WORD_LEFT]     = &prvActWord,
+    [CLI_ACT_PASTE_BEGIN]   = &prvActPaste,
+    [CLI_ACT_PASTE_END]     = &prvActPaste,
+};
+
+static void prvDispatchAction( int action )
+{
+    CLI_TRACE( CLI_TRACE_EV_ESC, action, 0 );
+    if ( action > CLI_ACT_NONE && action < CLI_ACT_COUNT && editorActions[action] != NULL ) {
+        editorActions[action]( action );
+    }
+}
+
+// Turn a completed CSI final byte into an action
+static int prvEscFinal( int c )
+{
+    int action = CLI_ACT_NONE;
+    unsigned int p0 = esc.params[0];
+
+    if ( c == CLI_CHAR_ESC_TILDE ) {
+        if ( p0 < sizeof(escTildeActions) ) {
+            action = escTildeActions[p0];
+        }
+#if CLI_HAS_BRACKETED_PASTE
+        // Only a terminal we asked for bracketed paste may start one
+        else if ( p0 == CLI_ESC_PASTE_BEGIN ) {
+            action = CLI_ACT_PASTE_BEGIN;
+        }
+        else if ( p0 == CLI_ESC_PASTE_END ) {
+            action = CLI_ACT_PASTE_END;
+        }
+#endif
+    }
+    else if ( c >= CLI_CHAR_ESC_FINAL_MIN && c <= CLI_CHAR_ESC_FINAL_MAX ) {
+        action = escFinalActions[c - CLI_CHAR_ESC_FINAL_MIN];
+    }
+
+    // 'ESC[1;5D' etc. Any modifier on left/right moves by word
+    if ( esc.paramCount > 1 && esc.params[1] > 1 ) {
+        if ( action == CLI_ACT_LEFT ) action = CLI_ACT_WORD_LEFT;
+        else if ( action == CLI_ACT_RIGHT ) action = CLI_ACT_WORD_RIGHT;
+    }
+    return action;
+}
+
+/* Incremental escape sequence decoder, one byte at a time (ex.)
+ * 'ESC'[A      - Up            'ESC'OA - Up (SS3)
+ * 'ESC'[3~     - Delete        'ESC'[1;5C - Ctrl + Right
+ * 'ESC'[200~   - Paste begin   0xE0 'H' - Up (console scan code)
+ * Returns a character for the line editor, or -1 if the byte was consumed.
+ */
+static int prvDecodeInput( int c )
+{
+    switch ( esc.state ) {
+    case CLI_ESC_ESCAPE:
+        if ( c == CLI_CHAR_ESC_PREFIX || c == CLI_CHAR_SS3_PREFIX ) {
+            esc.state = (c == CLI_CHAR_ESC_PREFIX)? CLI_ESC_CSI : CLI_ESC_SS3;
+            esc.paramCount = 0;
+            memset( esc.params, 0, sizeof(esc.params) );
+            return -1;
+        }
+        // Lone escape, drop it and handle this byte normally
+        esc.state = CLI_ESC_GROUND;
+        return prvDecodeInput( c );
+
+    case CLI_ESC_CSI:
+        if ( c >= '0' && c <= '9' ) {
+            if ( esc.paramCount == 0 ) esc.paramCount = 1;
+            if ( esc.paramCount <= CLI_ESC_MAX_PARAMS ) {
+                unsigned int *p = &esc.params[esc.paramCount - 1];
+                *p = (*p * 10) + (c - '0');
+                if ( *p > CLI_ESC_PARAM_MAX ) *p = CLI_ESC_PARAM_MAX;
+            }
+            return -1;
+        }
+        if ( c == ';' ) {
+            esc.paramCount += (esc.paramCount == 0)? 2 : 1;
+            return -1;
+        }
+        if ( c >= CLI_CHAR_PRINT_MIN && c < CLI_CHAR_ESC_FINAL_MIN ) {
+            // Private markers and intermediates are ignored
+            return -1;
+        }
+        // fall through
+    case CLI_ESC_SS3:
+        if ( c >= CLI_CHAR_ESC_FINAL_MIN && c <= CLI_CHAR_ESC_FINAL_MAX ) {
+            int action = (esc.state == CLI_ESC_SS3)? escSs3Actions[c - CLI_CHAR_ESC_FINAL_MIN] : prvEscFinal(c);
+            esc.state = CLI_ESC_GROUND;
+            prvDispatchAction( action );
+            return -1;
+        }
+        // Malformed sequence, handle this byte normally
+        esc.state = CLI_ESC_GROUND;
+        return prvDecodeInput( c );
+
+#if CLI_GET_CH
+    case CLI_ESC_SCAN:
+        esc.state = CLI_ESC_GROUND;
+        if ( c >= 0 && c <= CLI_CHAR_PRINT_MAX ) {
+            prvDispatchAction( escScanActions[c] );
+        }
+        return -1;
+#endif // CLI_GET_CH
+
+    default:
+        break;
+    }
+
+    if ( c == CLI_CHAR_ESCAPE ) {
+        esc.state = CLI_ESC_ESCAPE;
+        esc.start = prvGetTick();
+        return -1;
+    }
+#if CLI_GET_CH
+    if ( c == CLI_CHAR_SCAN_PREFIX || c == CLI_CHAR_SCAN_PREFIX_ALT ) {
+        esc.state = CLI_ESC_SCAN;
+        return -1;
+    }
+#endif // CLI_GET_CH
+    return c;
+}
+
+// Drop an incomplete sequence (e.g. a lone ESC key) or end a paste whose end
+// marker was lost once input goes quiet
+static void prvEscTimeout( void )
+{
+    if ( esc.state != CLI_ESC_GROUND && tickFn != NULL &&
+         (prvGetTick() - esc.start) >= CLI_MS_TO_TICKS(CLI_ESC_TIMEOUT_MS) ) {
+        esc.state = CLI_ESC_GROUND;
+    }
+    if ( flags.pasting && tickFn != NULL &&
+         (prvGetTick() - esc.pasteTick) >= CLI_MS_TO_TICKS(CLI_PASTE_TIMEOUT_MS) ) {
+        flags.pasting = 0;
+    }
+}
+
+// Handle a decoded character
+static void prvProcessChar( int c )
+{
+    int i, t;
+
+    /* A pasted line break or tab becomes one space, so pasted lines join and never run */
+    if ( flags.pasting ) {
+        esc.pasteTick = prvGetTick();
+        if ( c == CLI_CHAR_RETURN || c == CLI_CHAR_LINE_FEED || c == CLI_CHAR_TAB ) {
+            if ( currentCursorPosition > 0 && currentCommand[currentCursorPosition - 1] == CLI_CHAR_SPACE ) return;
+            c = CLI_CHAR_SPACE;
+        }
+    }
+
+    /* Standard Characters */
+    if (c >= CLI_CHAR_PRINT_MIN && c <= CLI_CHAR_PRINT_MAX && currentCommandLength < CLI_MAX_COMMAND_LENGTH ) {
+        if ( currentCursorPosition < currentCommandLength && flags.insertMode ) {
+            // Insert mode
+            prvPutChar(c);
+            currentCommand[ currentCursorPosition++ ] = c;
+        } else if ( currentCursorPosition < currentCommandLength ){
+            // Non-insert mode
+            i = currentCursorPosition;
+            ++currentCommandLength;
+            while ( i < currentCommandLength ) {
+                prvPutChar(c);
+                // Save character at current location
+                t = currentCommand[i];
+                // Insert new character
+                currentCommand[i++] = (char) c;
+                // Make pushed character new character and repeat
+                c = t;
+            }
+            ++currentCursorPosition;
+            // Move cursor back
+            while ( i-- > currentCursorPosition ) {
+                CLI_CURSOR_LEFT();
+            }
+        }
+        else {
+            prvPutChar(c);
+            currentCommand[ currentCommandLength++ ] = (char) c;
+            ++currentCursorPosition;
+        }
+    }
+    /* Control-C, also abandons a paste */
+    else if ( c == CLI_CHAR_CTRL_C ) {
+        flags.pasting = 0;
+        prvCallCtrlC();
+    }
+    /* Other control characters in pasted text are dropped */
+    else if ( flags.pasting ) {
+        return;
+    }
+    /* Show History */
+    else if ( c == CLI_CHAR_CTRL_S ) {
+        cli_printf( "%s%s%s", CLI_NEWLINE, CLI_NEWLINE, CLI_NEWLINE );
+        for ( i = 0; i <= CLI_MAX_COMMAND_HISTORY; i++ ) {
+            cli_printf( "%s(%d) %s%s", (i == historyCommand)? CLI_PROMPT : " ", i, commandHistory[i], CLI_NEWLINE );
+        }
+        cli_printf( "%s%s%s ", CLI_NEWLINE, CLI_NEWLINE, CLI_PROMPT );
+    }
+    /* Return Character */
+    else if ( c == CLI_CHAR_RETURN ) {
+        // Adjust for overflow
+        currentCommandLength = (currentCommandLength < CLI_MAX_COMMAND_LENGTH)? currentCommandLength : (CLI_MAX_COMMAND_LENGTH - 1);
+        currentCommand[currentCommandLength] = CLI_CHAR_NULL;
+        if ( currentCommandLength > 0 ) {
+            cli_printf( CLI_NEWLINE );
+            // Only add if it wasn't last command executed
+            if ( 0 != strncmp( currentCommand, commandHistory[CLI_COMMAND_PREV(currentCommandIdx)], CLI_MAX_COMMAND_LENGTH ) ) {
+                memcpy( commandHistory[currentCommandIdx], currentCommand, CLI_MAX_COMMAND_LENGTH );
+                currentCommandIdx = CLI_COMMAND_NEXT( currentCommandIdx );
+            }
+
+            historyCommand = currentCommandIdx;
+            prvCallCommand( currentCommand );
+            memset( currentCommand, 0, CLI_MAX_COMMAND_LENGTH );
+        }
+        currentCommandLength = 0;
+        currentCursorPosition = 0;
+        cli_printf( "%s%s ", flags.screenCleared? "" : CLI_NEWLINE, CLI_PROMPT );
+        CLI_MSG_PROMPTED();
+        flags.screenCleared = CLI_FALSE;
+        flags.insertMode = CLI_FALSE;
+    }
+    /* Backspace */
+    else if ( c == CLI_CHAR_BACKSPACE && currentCommandLength > 0 && currentCursorPosition > 0 ) {
+        // Cursor left
+        CLI_CURSOR_LEFT();
+        if ( currentCursorPosition < currentCommandLength ) {
+            // We are not at the end of the word
+            i = currentCursorPosition;
+            while ( i < currentCommandLength ) {
+                prvPutChar( currentCommand[i++] );
+            }
+            prvPutChar( CLI_CHAR_SPACE );
+            memmove( currentCommand + currentCursorPosition - 1, currentCommand + currentCursorPosition, currentCommandLength - currentCursorPosition );
+            currentCommand[ currentCommandLength - 1 ] = 0;
+            for ( i = 0; i <= currentCommandLength - currentCursorPosition; i++ ) {
+                // Move back to where we were
+                CLI_CURSOR_LEFT();
+            }
+            --currentCommandLength;
+        }
+        // Normal backspace
+        else {
+            // Erase Character
+            prvPutChar( CLI_CHAR_SPACE );
+            // Cursor left
+            CLI_CURSOR_LEFT();
+            currentCommand[ currentCommandLength-- ] = 0;
+        }
+        --currentCursorPosition;
+    }
+    /* Unkown Input */
+    else {
+        // Ring bell
+        prvPutChar( CLI_CHAR_BELL );
+        //cli_printf( "\n\r0x%02x\n\r%d\n\r", ((char) c), c );
+    }
+}
+
 // Blocking task to process input. Should not return.
 void cli_task( void *params )
 {
@@ -384,212 +2811,58 @@ void cli_task( void *params )
     CLI_INIT( getCharFn, putCharFn );
 
     // Set all task variables to default states
+    CLI_LOCK();
+#if CLI_HAS_BRACKETED_PASTE
+    cli_printf( CLI_STRING_PASTE_ON );
+#endif
     cli_printf( "%s%s ", CLI_INIT_TEXT, CLI_PROMPT );
     historyCommand = 0;
     currentCommandIdx = 0;
     memset( commandHistory, 0, sizeof(commandHistory) );
     memset( currentCommand, 0, sizeof(currentCommand) );
+    memset( &esc, 0, sizeof(esc) );
+    CLI_TRACE_FLUSH();
+    CLI_STACK_INIT();
+    CLI_UNLOCK();
 
-    int c, i, t;
+    int c;
 
     while ( getCharFn != NULL && putCharFn != NULL ) {
         c = prvGetChar();
-        if ( c < 0 ) continue;
+        CLI_LOCK();
+        if ( c < 0 ) {
+            // No input available
+            prvEscTimeout();
+            CLI_MSG_IDLE();
+            CLI_ZIP_FLUSH();
+            CLI_RECORD_FLUSH();
+            CLI_UNLOCK();
+            continue;
+        }
+        CLI_TRACE( CLI_TRACE_EV_RX, c, 0 );
 
 #if CLI_ONLY_SHOW_ASCII
         cli_printf( "0x%02x%s", c, CLI_NEWLINE );
         prvPutChar( CLI_CHAR_BELL );
 #else
-        /* Standard Characters */
-        if (c >= CLI_CHAR_PRINT_MIN && c <= CLI_CHAR_PRINT_MAX && currentCommandLength < CLI_MAX_COMMAND_LENGTH ) {
-            if ( currentCursorPosition < currentCommandLength && flags.insertMode ) {
-                // Insert mode
-                prvPutChar(c);
-                currentCommand[ currentCursorPosition++ ] = c;
-            } else if ( currentCursorPosition < currentCommandLength ){
-                // Non-insert mode
-                i = currentCursorPosition;
-                ++currentCommandLength;
-                while ( i < currentCommandLength ) {
-                    prvPutChar(c);
-                    // Save character at current location
-                    t = currentCommand[i];
-                    // Insert new character
-                    currentCommand[i++] = (char) c;
-                    // Make pushed character new character and repeat
-                    c = t;
-                }
-                ++currentCursorPosition;
-                // Move cursor back
-                while ( i-- > currentCursorPosition ) {
-                    CLI_CURSOR_LEFT();
-                }
-            }
-            else {
-                prvPutChar(c);
-                currentCommand[ currentCommandLength++ ] = (char) c;
-                ++currentCursorPosition;
-            }
-        }
-        /* Control-C */
-        else if ( c == CLI_CHAR_CTRL_C ) {
-            prvCallCtrlC();
-        }
-        /* Show History */
-        else if ( c == CLI_CHAR_CTRL_S ) {
-            cli_printf( "%s%s%s", CLI_NEWLINE, CLI_NEWLINE, CLI_NEWLINE );
-            for ( i = 0; i <= CLI_MAX_COMMAND_HISTORY; i++ ) {
-                cli_printf( "%s(%d) %s%s", (i == historyCommand)? CLI_PROMPT : " ", i, commandHistory[i], CLI_NEWLINE );
-            }
-            cli_printf( "%s%s%s ", CLI_NEWLINE, CLI_NEWLINE, CLI_PROMPT );
-        }
-        /* Return Character */
-        else if ( c == CLI_CHAR_RETURN ) {
-            // Adjust for overflow
-            currentCommandLength = (currentCommandLength < CLI_MAX_COMMAND_LENGTH)? currentCommandLength : (CLI_MAX_COMMAND_LENGTH - 1);
-            currentCommand[currentCommandLength] = CLI_CHAR_NULL;
-            if ( currentCommandLength > 0 ) {
-                cli_printf( CLI_NEWLINE );
-                // Only add if it wasn't last command executed
-                if ( 0 != strncmp( currentCommand, commandHistory[CLI_COMMAND_PREV(currentCommandIdx)], CLI_MAX_COMMAND_LENGTH ) ) {
-                    memcpy( commandHistory[currentCommandIdx], currentCommand, CLI_MAX_COMMAND_LENGTH );
-                    currentCommandIdx = CLI_COMMAND_NEXT( currentCommandIdx );
-                }
-
-                historyCommand = currentCommandIdx;
-                prvCallCommand( currentCommand );
-                memset( currentCommand, 0, CLI_MAX_COMMAND_LENGTH );
-            }
-            currentCommandLength = 0;
-            currentCursorPosition = 0;
-            cli_printf( "%s%s ", flags.screenCleared? "" : CLI_NEWLINE, CLI_PROMPT );
-            flags.screenCleared = CLI_FALSE;
-            flags.insertMode = CLI_FALSE;
-        }
-        /* Backspace */
-        else if ( c == CLI_CHAR_BACKSPACE && currentCommandLength > 0 && currentCursorPosition > 0 ) {
-            // Cursor left
-            CLI_CURSOR_LEFT();
-            if ( currentCursorPosition < currentCommandLength ) {
-                // We are not at the end of the word
-                i = currentCursorPosition;
-                while ( i < currentCommandLength ) {
-                    prvPutChar( currentCommand[i++] );
-                }
-                prvPutChar( CLI_CHAR_SPACE );
-                memmove( currentCommand + currentCursorPosition - 1, currentCommand + currentCursorPosition, currentCommandLength - currentCursorPosition );
-                currentCommand[ currentCommandLength - 1 ] = 0;
-                for ( i = 0; i <= currentCommandLength - currentCursorPosition; i++ ) {
-                    // Move back to where we were
-                    CLI_CURSOR_LEFT();
-                }
-                --currentCommandLength;
-            }
-            // Normal backspace
-            else {
-                // Erase Character
-                prvPutChar( CLI_CHAR_SPACE );
-                // Cursor left
-                CLI_CURSOR_LEFT();
-                currentCommand[ currentCommandLength-- ] = 0;
-            }
-            --currentCursorPosition;
-        }
-        /* Arrow keys (and others) are implemented as escape sequeneces (ex.)
-         * 'ESC'[A - Up
-         * 'ESC'[B - Down
-         * 'ESC'[C - Right
-         * 'ESC'[D - Left
-         */
-        else if ( c == CLI_CHAR_ESCAPE_READ ) {
-#if CLI_ESC_HAS_PREFIX
-            if ( prvGetChar() != CLI_CHAR_ESC_PREFIX ) continue;
-#endif
-            c = prvGetChar();
-            /* Delete */
-            if ( c == CLI_CHAR_DELETE_READ && currentCommandLength > 0 && currentCursorPosition < currentCommandLength ) {
-                for ( i = currentCursorPosition + 1; i < currentCommandLength; i++ ) {
-                    prvPutChar( currentCommand[i] );
-                }
-                prvPutChar( CLI_CHAR_SPACE );
-                for ( i = 1; i <= currentCommandLength - currentCursorPosition; i++ ) {
-                    // Move back to where we were
-                    CLI_CURSOR_LEFT();
-                }
-                memmove( currentCommand + currentCursorPosition, currentCommand + currentCursorPosition + 1, (currentCommandLength - currentCursorPosition) + 1 );
-                currentCommand[ --currentCommandLength ] = 0;
-            }
-            /* Insert */
-            else if ( c == CLI_CHAR_INSERT_READ ) {
-#if CLI_HAS_INSERT_MODE
-                flags.insertMode = !flags.insertMode;
-                if ( !flags.insertMode ) {
-                    // If leaving mode, clean up next character
-                    prvPutChar( (currentCursorPosition == currentCommandLength)? CLI_CHAR_SPACE : currentCommand[ currentCursorPosition ] );
-                    CLI_CURSOR_LEFT();
-                }
-#else
-                // We are ignoring this input
-                flags.insertMode = CLI_FALSE;
-#endif // CLI_HAS_INSERT_MODE
-            }
-            else if ( c == CLI_CHAR_ARROW_UP_READ || c == CLI_CHAR_ARROW_DOWN_READ ) {
-                /* Up */
-                if ( c == CLI_CHAR_ARROW_UP_READ && CLI_COMMAND_PREV(historyCommand) != currentCommandIdx ) {
-                    if ( historyCommand == currentCommandIdx ) {
-                        memcpy( commandHistory[currentCommandIdx], currentCommand, CLI_MAX_COMMAND_LENGTH );
-                    }
-                    if ( commandHistory[ CLI_COMMAND_PREV(historyCommand) ][0] == 0 ) {
-                        prvPutChar( CLI_CHAR_BELL );
-                    }
-                    else {
-                        historyCommand = CLI_COMMAND_PREV( historyCommand );
-                    }
-                }
-                /* Down */
-                else if ( c == CLI_CHAR_ARROW_DOWN_READ && historyCommand != currentCommandIdx ) {
-                    if ( commandHistory[ CLI_COMMAND_NEXT(historyCommand) ][0] == 0 ) {
-                        prvPutChar( CLI_CHAR_BELL );
-                    }
-                    else {
-                        historyCommand = CLI_COMMAND_NEXT( historyCommand );
-                    }
-                }
-
-                memcpy( currentCommand, commandHistory[historyCommand], CLI_MAX_COMMAND_LENGTH );
-                cli_printf( "%c%c%c%c%s %s", CLI_CHAR_ESCAPE, CLI_CHAR_ESC_PREFIX, 'M', CLI_CHAR_RETURN, CLI_PROMPT, currentCommand );
-                currentCursorPosition = strnlen( currentCommand, CLI_MAX_COMMAND_LENGTH );
-                currentCommandLength = currentCursorPosition;
-            }
-            /* Right */
-            else if ( c == CLI_CHAR_ARROW_RIGHT_READ && currentCursorPosition < currentCommandLength ) {
-                prvPutChar( currentCommand[currentCursorPosition++] );
-            }
-            /* Left */
-            else if ( c == CLI_CHAR_ARROW_LEFT_READ && currentCursorPosition != 0 ) {
-                if ( flags.insertMode ) {
-                    prvPutChar( (currentCursorPosition == currentCommandLength)? CLI_CHAR_SPACE : currentCommand[currentCursorPosition] );
-                    CLI_CURSOR_LEFT();
-                }
-                --currentCursorPosition;
-                CLI_CURSOR_LEFT();
-            }
-        }
-        /* Unkown Input */
-        else {
-            // Ring bell
-            prvPutChar( CLI_CHAR_BELL );
-            //cli_printf( "\n\r0x%02x\n\r%d\n\r", ((char) c), c );
+        c = prvDecodeInput( c );
+        if ( c >= 0 ) {
+            prvProcessChar( c );
         }
+        CLI_TRACE_FLUSH();
 
         // If in insert mode, display cursor properly
-        if ( flags.insertMode ) {
+        if ( flags.insertMode && esc.state == CLI_ESC_GROUND ) {
             cli_printf( "\033[7m%c%c%c%c%s",
                 (currentCursorPosition == currentCommandLength)? CLI_CHAR_SPACE : currentCommand[currentCursorPosition],
                 CLI_CHAR_ESCAPE, CLI_CHAR_ESC_PREFIX, CLI_CHAR_ARROW_LEFT, CLI_COLOR_DEFAULT );
         }
 
 #endif // CLI_ONLY_SHOW_ASCII
+        CLI_MSG_FLUSH();
+        CLI_ZIP_FLUSH();
+        CLI_RECORD_FLUSH();
+        CLI_UNLOCK();
     }
 
 #if CLI_RTOS_TASK_DELETE
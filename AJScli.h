@@ -16,6 +16,8 @@
 #ifndef AJS_CLI_H
 #define AJS_CLI_H
 
+#include <stdarg.h>       // va_list in cli_vprintf
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -57,6 +59,20 @@ extern "C" {
     #define CLI_INIT(x, y)
 #endif // CLI_INIT
 
+// Recursive lock taken by cli_task while it handles input, and by cli_execute
+// and cli_printf_msg; define both when those run in several tasks
+#ifndef CLI_LOCK
+    #define CLI_LOCK()
+    #define CLI_UNLOCK()
+#endif // CLI_LOCK
+
+// Held only for one write to the transport; define both when cli_log_* run
+// in other tasks, so frames are not interleaved with other output
+#ifndef CLI_OUT_LOCK
+    #define CLI_OUT_LOCK()
+    #define CLI_OUT_UNLOCK()
+#endif // CLI_OUT_LOCK
+
 /* ===== CLI Types ===== */
 typedef long CliType_t;
 
@@ -130,37 +146,206 @@ typedef long CliType_t;
 #define CLI_PROMPT                  CLI_COLOR_DEFAULT ">"
 #endif
 
+#ifndef CLI_TICKS_PER_SEC
+#define CLI_TICKS_PER_SEC           (1000)
+#endif
+
+#ifndef CLI_ESC_TIMEOUT_MS
+#define CLI_ESC_TIMEOUT_MS          (50)
+#endif
+
+#ifndef CLI_HAS_BRACKETED_PASTE
+#define CLI_HAS_BRACKETED_PASTE     (0)
+#endif
+
+#ifndef CLI_PASTE_TIMEOUT_MS
+#define CLI_PASTE_TIMEOUT_MS        (500)
+#endif
+
+/* ===== Optional CLI Features ===== */
+#ifndef CLI_HAS_SEQUENCE
+#define CLI_HAS_SEQUENCE            (1)
+#endif
+
+#ifndef CLI_HAS_REPEAT
+#define CLI_HAS_REPEAT              (1)
+#endif
+
+#ifndef CLI_HAS_PACKED_TEXT
+#define CLI_HAS_PACKED_TEXT         (0)
+#endif
+
+#ifndef CLI_PACKED_CHUNK
+#define CLI_PACKED_CHUNK            (32)
+#endif
+
+#ifndef CLI_HAS_TRACE
+#define CLI_HAS_TRACE               (0)
+#endif
+
+#ifndef CLI_TRACE_DEPTH
+#define CLI_TRACE_DEPTH             (128)
+#endif
+
+#ifndef CLI_HAS_BINARY_LOG
+#define CLI_HAS_BINARY_LOG          (0)
+#endif
+
+#ifndef CLI_HAS_MEMORY_CMDS
+#define CLI_HAS_MEMORY_CMDS         (0)
+#endif
+
+#ifndef CLI_MD_BYTES_PER_LINE
+#define CLI_MD_BYTES_PER_LINE       (16)
+#endif
+#if CLI_MD_BYTES_PER_LINE <= 0 || (CLI_MD_BYTES_PER_LINE % 4) != 0
+#error "CLI_MD_BYTES_PER_LINE must be a positive multiple of 4"
+#endif
+
+#ifndef CLI_HAS_XFER
+#define CLI_HAS_XFER                (0)
+#endif
+
+#ifndef CLI_XFER_TIMEOUT_MS
+#define CLI_XFER_TIMEOUT_MS         (1000)
+#endif
+
+#ifndef CLI_XFER_RETRIES
+#define CLI_XFER_RETRIES            (10)
+#endif
+
+#ifndef CLI_XFER_START_TRIES
+#define CLI_XFER_START_TRIES        (60)
+#endif
+
+#ifndef CLI_HAS_COMPRESS
+#define CLI_HAS_COMPRESS            (0)
+#endif
+
+#ifndef CLI_COMPRESS_BUF
+#define CLI_COMPRESS_BUF            (128)
+#endif
+
+#ifndef CLI_HAS_RECORD
+#define CLI_HAS_RECORD              (0)
+#endif
+
+#ifndef CLI_RECORD_BUF
+#define CLI_RECORD_BUF              (64)
+#endif
+
+#ifndef CLI_HAS_SCRATCH
+#define CLI_HAS_SCRATCH             (0)
+#endif
+
+#ifndef CLI_SCRATCH_SIZE
+#define CLI_SCRATCH_SIZE            (1024)
+#endif
+
+#ifndef CLI_SCRATCH_ALIGN
+#define CLI_SCRATCH_ALIGN           (8)
+#endif
+
+#ifndef CLI_HAS_MEM_REPORT
+#define CLI_HAS_MEM_REPORT          (0)
+#endif
+
+#ifndef CLI_STACK_PAINT_SIZE
+#define CLI_STACK_PAINT_SIZE        (0)
+#endif
+
+#ifndef CLI_STACK_CMDS
+#define CLI_STACK_CMDS              (8)
+#endif
+
+#ifndef CLI_HAS_MSG_LIMIT
+#define CLI_HAS_MSG_LIMIT           (0)
+#endif
+
+#ifndef CLI_MSG_SITES
+#define CLI_MSG_SITES               (8)
+#endif
+
+#ifndef CLI_MSG_RATE
+#define CLI_MSG_RATE                (5)
+#endif
+
+#ifndef CLI_MSG_BURST
+#define CLI_MSG_BURST               (10)
+#endif
+
+#ifndef CLI_MSG_REPEAT_MS
+#define CLI_MSG_REPEAT_MS           (1000)
+#endif
+
+#ifndef CLI_LOG_LEVEL_MIN
+#define CLI_LOG_LEVEL_MIN           (CLI_LOG_LEVEL_TRACE)
+#endif
+
+#ifndef CLI_LOG_LEVEL_DEFAULT
+#define CLI_LOG_LEVEL_DEFAULT       (CLI_LOG_LEVEL_INFO)
+#endif
+
 /* ===== CLI Constants ===== */
 #define CLI_CHAR_PRINT_MIN          (0x20)
 #define CLI_CHAR_PRINT_MAX          (0x7E)
 #define CLI_CHAR_CTRL_S             (0x13)
 #define CLI_CHAR_CTRL_C             (0x03)
 #define CLI_CHAR_RETURN             (0x0D)
+#define CLI_CHAR_LINE_FEED          (0x0A)
+#define CLI_CHAR_TAB                (0x09)
 #define CLI_CHAR_ESCAPE             (0x1B)
 #define CLI_CHAR_BACKSPACE          (0x08)
 #define CLI_CHAR_NULL               (0x00)
 #define CLI_CHAR_BELL               (0x07)
 #define CLI_CHAR_SPACE              (' ')
+#define CLI_CHAR_SEQ_ALWAYS         (';')
+#define CLI_CHAR_SEQ_AND            ('&')
+#define CLI_CHAR_SEQ_OR             ('|')
 #define CLI_CHAR_ESC_PREFIX         ('[')
+#define CLI_CHAR_SS3_PREFIX         ('O')
+#define CLI_CHAR_ESC_TILDE          ('~')
+#define CLI_CHAR_ESC_FINAL_MIN      (0x40)
+#define CLI_CHAR_ESC_FINAL_MAX      (0x7E)
 #define CLI_CHAR_ARROW_UP           ('A')
 #define CLI_CHAR_ARROW_DOWN         ('B')
 #define CLI_CHAR_ARROW_RIGHT        ('C')
 #define CLI_CHAR_ARROW_LEFT         ('D')
+#define CLI_CHAR_HOME               ('H')
+#define CLI_CHAR_END                ('F')
 #define CLI_CHAR_INSERT             ('O')
 #define CLI_CHAR_DELETE             ('P')
+#define CLI_CHAR_PACKED             (0x01)
+
+/* ===== YMODEM Constants ===== */
+#define CLI_XFER_SOH                (0x01)
+#define CLI_XFER_STX                (0x02)
+#define CLI_XFER_EOT                (0x04)
+#define CLI_XFER_ACK                (0x06)
+#define CLI_XFER_NAK                (0x15)
+#define CLI_XFER_CAN                (0x18)
+#define CLI_XFER_CRC                ('C')
+#define CLI_XFER_PAD                (0x1A)
+#define CLI_XFER_BLOCK_SMALL        (128)
+#define CLI_XFER_BLOCK              (1024)
 #define CLI_STRING_CLEAR            "\033[1;1H\033[2J"
+#define CLI_STRING_PASTE_ON         "\033[?2004h"
 
 #if CLI_GET_CH
-    #define CLI_CHAR_ESCAPE_READ        (0xE0)
+    #define CLI_CHAR_SCAN_PREFIX        (0xE0)
+    #define CLI_CHAR_SCAN_PREFIX_ALT    (0x00)
+#endif // CLI_GET_CH
+
+// Keys as read by getChar, kept for code written against the old reader.
+// The console scan codes index escScanActions.
+#if CLI_GET_CH
+    #define CLI_CHAR_ESCAPE_READ        (CLI_CHAR_SCAN_PREFIX)
     #define CLI_CHAR_ARROW_UP_READ      ('H')
     #define CLI_CHAR_ARROW_DOWN_READ    ('P')
     #define CLI_CHAR_ARROW_RIGHT_READ   ('M')
     #define CLI_CHAR_ARROW_LEFT_READ    ('K')
     #define CLI_CHAR_INSERT_READ        ('R')
     #define CLI_CHAR_DELETE_READ        ('S')
-    #ifndef CLI_ESC_HAS_PREFIX
-        #define CLI_ESC_HAS_PREFIX      (0)
-    #endif
 #else
     #define CLI_CHAR_ESCAPE_READ        (CLI_CHAR_ESCAPE)
     #define CLI_CHAR_ARROW_UP_READ      (CLI_CHAR_ARROW_UP)
@@ -169,22 +354,95 @@ typedef long CliType_t;
     #define CLI_CHAR_ARROW_LEFT_READ    (CLI_CHAR_ARROW_LEFT)
     #define CLI_CHAR_INSERT_READ        (CLI_CHAR_INSERT)
     #define CLI_CHAR_DELETE_READ        (CLI_CHAR_DELETE)
-    #ifndef CLI_ESC_HAS_PREFIX
-        #define CLI_ESC_HAS_PREFIX      (1)
-    #endif
 #endif // CLI_GET_CH
 
+// No longer has an effect: 'ESC[' sequences and scan codes are both decoded
+#ifndef CLI_ESC_HAS_PREFIX
+    #define CLI_ESC_HAS_PREFIX          (0)
+#endif
+
 #define CLI_PRINTF_BUF                  (CLI_MAX_COMMAND_LENGTH)
 
+/* ===== CLI Trace Events ===== */
+#define CLI_TRACE_MAGIC             "\002AJT"
+#define CLI_TRACE_VERSION           (1)
+#define CLI_TRACE_EV_RX             (1)     // arg8: byte received
+#define CLI_TRACE_EV_ESC            (2)     // arg8: editor action decoded
+#define CLI_TRACE_EV_DISPATCH       (3)     // arg8: list slot, arg16: command index
+#define CLI_TRACE_EV_RETURN         (4)     // arg16: command return code
+#define CLI_TRACE_EV_FLUSH          (5)     // arg16: bytes handed to putChar
+#define CLI_TRACE_EV_MSG            (6)     // arg16: bytes of cli_printf_msg
+
+/* ===== CLI Binary Log Levels ===== */
+#define CLI_LOG_LEVEL_TRACE         (0)
+#define CLI_LOG_LEVEL_DEBUG         (1)
+#define CLI_LOG_LEVEL_INFO          (2)
+#define CLI_LOG_LEVEL_WARN          (3)
+#define CLI_LOG_LEVEL_ERROR         (4)
+#define CLI_LOG_LEVEL_NONE          (5)
+
+#define CLI_LOG_SECTION             "cli_fmt"
+#define CLI_LOG_FRAME_START         (0x02)
+#define CLI_LOG_FRAME_TYPE          ('L')
+#define CLI_LOG_FRAME_MAX           (255)
+
+#define CLI_LOG_TAG_END             (0)
+#define CLI_LOG_TAG_INT             (1)     // zigzag varint
+#define CLI_LOG_TAG_UINT            (2)     // varint
+#define CLI_LOG_TAG_DOUBLE          (3)     // 8 byte IEEE 754, little endian
+#define CLI_LOG_TAG_STRING          (4)     // u8 length + bytes
+#define CLI_LOG_TAG_POINTER         (5)     // varint
+
+/* ===== CLI Output Compression =====
+ * After 'compress on' (answered with an empty frame), transport output is sent
+ * as CLI_ZIP_FRAME_START 'Z' <len:2 LE> <payload>. The payload is LZSS over one
+ * stream with a 256 byte window: a flag byte (LSB first, 1 = match) precedes
+ * each group of 8 items; a literal is one byte, a match is <distance - 1>
+ * <length - CLI_ZIP_MATCH_MIN>. Output that would not shrink is sent as is
+ * and still counts as history. tools/clizip decodes it.
+ */
+#define CLI_ZIP_FRAME_START         (0x02)
+#define CLI_ZIP_FRAME_TYPE          ('Z')
+#define CLI_ZIP_WINDOW              (256)
+#define CLI_ZIP_MATCH_MIN           (3)
+#define CLI_ZIP_MATCH_MAX           (CLI_ZIP_MATCH_MIN + 255)
+
+/* ===== CLI Session Recording =====
+ * cli_setRecordOp streams "AJSR" <version> <ticks per second:varint>, then one
+ * record per input byte or output burst: <type> <ticks since last record:varint>
+ * followed by the input byte, or by <len:varint> and the bytes sent on the
+ * transport. examples/Linux/replay plays a recording back against the simulator.
+ */
+#define CLI_RECORD_MAGIC            "AJSR"
+#define CLI_RECORD_VERSION          (1)
+#define CLI_RECORD_EV_IN            (1)
+#define CLI_RECORD_EV_OUT           (2)
+
+/* ===== CLI Packed Text =====
+ * Wrap usage/help strings as CLI_TEXT(ID, "text"). With CLI_HAS_PACKED_TEXT,
+ * tools/clitext generates AJScliText.h from the sources, replacing each string
+ * with a short reference into one compressed blob.
+ */
+#if CLI_HAS_PACKED_TEXT
+    #include "AJScliText.h"
+    #define CLI_TEXT(id, str)           CLI_TEXT_##id
+#else
+    #define CLI_TEXT(id, str)           str
+#endif // CLI_HAS_PACKED_TEXT
+
 /* ===== CLI Utility Macros ===== */
 #define CLI_COMMAND_NEXT(x)             (( ((x) + 1) > CLI_MAX_COMMAND_HISTORY )? 0 : ((x) + 1))
 #define CLI_COMMAND_PREV(x)             (( ((x) - 1) == -1)? (CLI_MAX_COMMAND_HISTORY) : ((x) - 1))
+#define CLI_MS_TO_TICKS(ms)             ((unsigned long) (((unsigned long long) (ms) * CLI_TICKS_PER_SEC) / 1000))
 
 /* ===== CLI Public Structures/Defines ===== */
 typedef CliType_t (*CliCommandFn_t)(int argc, char *argv[]);
 typedef int (*CliGetCharFn_t)(void);
 typedef void (*CliPutCharFn_t)(int c);
 typedef void (*CliCtrlCFn_t)(void *arg);
+typedef unsigned long (*CliTickFn_t)(void);
+typedef void (*CliWriteFn_t)(const char *data, int len);
+typedef void (*CliRecordFn_t)(void *ctx, const unsigned char *data, int len);
 
 typedef struct {
     const char *command;
@@ -194,23 +452,146 @@ typedef struct {
 } CliCommand_t;
 
 typedef struct {
-    CliCommand_t *commands;
+    const CliCommand_t *commands;
     int count;
+    int sorted;
 } CliCommandList_t;
 
+typedef void (*CliSinkFn_t)(void *ctx, const char *data, int len);
+
+// Output destination for cli_execute. Either or both of buf and fn may be set;
+// buf is kept NULL terminated and len/dropped count what fit and what did not.
+typedef struct {
+    char *buf;
+    int size;
+    int len;
+    int dropped;
+    CliSinkFn_t fn;
+    void *ctx;
+} CliSink_t;
+
+// Storage behind the rx/tx commands. open is given the file name and size
+// (0 if the sender did not say) when receiving, and fills in size when sending.
+// read/write return the number of bytes moved or a negative value on error.
+typedef struct {
+    CliType_t (*open)(void *ctx, const char *name, unsigned long *size, int writing);
+    int (*read)(void *ctx, unsigned long offset, char *data, int len);
+    int (*write)(void *ctx, unsigned long offset, const char *data, int len);
+    void (*close)(void *ctx, CliType_t status);
+    void *ctx;
+} CliXferOps_t;
+
 /* ===== CLI Public Functions ===== */
 int cli_vprintf( const char *fmt, va_list ap );
 int cli_printf( const char *fmt, ... );
 int cli_printf_msg( const char *fmt, ... );
-CliType_t cli_addList( CliCommand_t *list, int count );
+CliType_t cli_execute( const char *line, CliSink_t *out );
+CliType_t cli_addList( const CliCommand_t *list, int count );
+CliType_t cli_addSortedList( const CliCommand_t *list, int count );
+CliType_t cli_removeList( const CliCommand_t *list );
+CliType_t cli_replaceList( const CliCommand_t *old, const CliCommand_t *list, int count );
 void cli_setCtrlCOp( CliCtrlCFn_t ctrlC, void *args );
+void cli_setTickOp( CliTickFn_t tick );
+void cli_setWriteOp( CliWriteFn_t write );
 CliType_t cli_init( void );
 void cli_task( void *params );
 
+#if CLI_HAS_XFER
+void cli_setXferOps( const CliXferOps_t *ops );
+#endif
+
+#if CLI_HAS_RECORD
+void cli_setRecordOp( CliRecordFn_t record, void *ctx );
+#endif
+
+#if CLI_HAS_MSG_LIMIT
+void cli_msgFlush( void );
+#endif
+
+#if CLI_HAS_SCRATCH
+void *cli_scratch( unsigned int size );
+unsigned int cli_scratchHighWater( void );
+#endif
+
 #if CLI_SET_OPS
 CliType_t cli_setOps( CliGetCharFn_t getChar, CliPutCharFn_t putChar );
 #endif
 
+#if CLI_HAS_BINARY_LOG
+/* ===== CLI Binary Log =====
+ * cli_log_info( "adc %d = %f", ch, volts ) sends only the address of the format
+ * string within the CLI_LOG_SECTION section plus the raw arguments, framed as
+ * CLI_LOG_FRAME_START 'L' <len> <level> <id:4> <args>. The section does not have
+ * to be loaded on target; tools/clilog reads it from the ELF and formats on the
+ * host. Target linker script (GNU ld):
+ *
+ *     cli_fmt 0 (INFO) : { __start_cli_fmt = .; KEEP(*(cli_fmt)) }
+ *
+ * Requires GCC/Clang (section attribute, ##__VA_ARGS__) and C11 _Generic.
+ * Arguments may be integers, floating point, strings or void pointers; at most 8.
+ */
+typedef struct {
+    unsigned char tag;
+    union {
+        long long i;
+        unsigned long long u;
+        double f;
+        const char *s;
+    } v;
+} CliLogArg_t;
+
+extern volatile int cliLogLevel;
+extern const char __start_cli_fmt[];
+
+void cli_log_write( int level, const char *fmt, const CliLogArg_t *args, int count );
+void cli_setLogLevel( int level );
+
+static inline CliLogArg_t cli_logArgInt( long long v )      { CliLogArg_t a; a.tag = CLI_LOG_TAG_INT; a.v.i = v; return a; }
+static inline CliLogArg_t cli_logArgUint( unsigned long long v ) { CliLogArg_t a; a.tag = CLI_LOG_TAG_UINT; a.v.u = v; return a; }
+static inline CliLogArg_t cli_logArgDouble( double v )      { CliLogArg_t a; a.tag = CLI_LOG_TAG_DOUBLE; a.v.f = v; return a; }
+static inline CliLogArg_t cli_logArgString( const char *v ) { CliLogArg_t a; a.tag = CLI_LOG_TAG_STRING; a.v.s = v; return a; }
+static inline CliLogArg_t cli_logArgPointer( const void *v ) { CliLogArg_t a; a.tag = CLI_LOG_TAG_POINTER; a.v.u = (unsigned long long) (size_t) v; return a; }
+
+#define CLI_LOG_ARG(x)  _Generic( (x),                                  \
+        float: cli_logArgDouble,            double: cli_logArgDouble,   \
+        char *: cli_logArgString,           const char *: cli_logArgString, \
+        void *: cli_logArgPointer,          const void *: cli_logArgPointer, \
+        _Bool: cli_logArgUint,              unsigned char: cli_logArgUint, \
+        unsigned short: cli_logArgUint,     unsigned int: cli_logArgUint, \
+        unsigned long: cli_logArgUint,      unsigned long long: cli_logArgUint, \
+        default: cli_logArgInt )( x ),
+
+#define CLI_LOG_A0()
+#define CLI_LOG_A1(a)           CLI_LOG_ARG(a)
+#define CLI_LOG_A2(a, ...)      CLI_LOG_ARG(a) CLI_LOG_A1(__VA_ARGS__)
+#define CLI_LOG_A3(a, ...)      CLI_LOG_ARG(a) CLI_LOG_A2(__VA_ARGS__)
+#define CLI_LOG_A4(a, ...)      CLI_LOG_ARG(a) CLI_LOG_A3(__VA_ARGS__)
+#define CLI_LOG_A5(a, ...)      CLI_LOG_ARG(a) CLI_LOG_A4(__VA_ARGS__)
+#define CLI_LOG_A6(a, ...)      CLI_LOG_ARG(a) CLI_LOG_A5(__VA_ARGS__)
+#define CLI_LOG_A7(a, ...)      CLI_LOG_ARG(a) CLI_LOG_A6(__VA_ARGS__)
+#define CLI_LOG_A8(a, ...)      CLI_LOG_ARG(a) CLI_LOG_A7(__VA_ARGS__)
+#define CLI_LOG_SELECT(_0, _1, _2, _3, _4, _5, _6, _7, _8, x, ...)   x
+#define CLI_LOG_ARGS(...)       CLI_LOG_SELECT(_0, ##__VA_ARGS__, CLI_LOG_A8, CLI_LOG_A7, CLI_LOG_A6, \
+                                    CLI_LOG_A5, CLI_LOG_A4, CLI_LOG_A3, CLI_LOG_A2, CLI_LOG_A1, CLI_LOG_A0)(__VA_ARGS__)
+
+// Level is checked before any argument is evaluated
+#define cli_log(level, fmt, ...)                                                    \
+    do {                                                                            \
+        if ( (level) >= CLI_LOG_LEVEL_MIN && (level) >= cliLogLevel ) {             \
+            static const char cliLogFmt[] __attribute__((section(CLI_LOG_SECTION), used)) = fmt; \
+            const CliLogArg_t cliLogArgs[] = { CLI_LOG_ARGS(__VA_ARGS__) { CLI_LOG_TAG_END, { 0 } } }; \
+            cli_log_write( (level), cliLogFmt, cliLogArgs,                          \
+                (int) (sizeof(cliLogArgs) / sizeof(cliLogArgs[0])) - 1 );           \
+        }                                                                           \
+    } while ( 0 )
+
+#define cli_log_trace(fmt, ...)     cli_log( CLI_LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__ )
+#define cli_log_dbg(fmt, ...)       cli_log( CLI_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__ )
+#define cli_log_info(fmt, ...)      cli_log( CLI_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__ )
+#define cli_log_warn(fmt, ...)      cli_log( CLI_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__ )
+#define cli_log_err(fmt, ...)       cli_log( CLI_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__ )
+#endif // CLI_HAS_BINARY_LOG
+
 #if CLI_HAS_COLOR_PRINT
     #define cli_printf_err(...)                 \
         do {                                    \
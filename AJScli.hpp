@@ -0,0 +1,295 @@
+/*******************************************************************
+
+                Adam Seidman C++ CLI Header
+
+********************************************************************
+
+ File Name:             AJScli.hpp
+ Compiler:              C++17
+ Author:                Adam Seidman
+ License:               MIT
+
+ Typed command handlers on top of AJScli.h. Handler parameters are
+ converted and range checked by code generated for their types, and
+ command tables are sorted at compile time so lookups binary search.
+
+    enum class Led { Red, Green };
+    template <> struct ajs::EnumNames<Led> {
+        static constexpr std::pair<std::string_view, Led> names[] = {
+            { "red", Led::Red }, { "green", Led::Green },
+        };
+    };
+
+    static CliType_t setLed( Led led, ajs::Range<int, 0, 100> duty, std::optional<float> hz );
+
+    static constexpr auto commands = ajs::commandTable(
+        ajs::command<&setLed>( "led", "<red|green> <0-100> [hz]", "Set LED duty" ),
+        ajs::command<&dump>( "dump", "<addr> <len>", "Dump memory" )
+    );
+
+    ajs::addList( commands );
+
+ Supported parameters: integers (base prefixes as in strtol), float,
+ double, bool (1/0/on/off/true/false), enums with EnumNames,
+ std::string_view, const char *, ajs::Range<T, Lo, Hi> and trailing
+ std::optional<T>. Handlers return CliType_t or void.
+
+*******************************************************************/
+
+#ifndef AJS_CLI_HPP
+#define AJS_CLI_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "AJScli.h"
+
+namespace ajs {
+
+// Parameter that must lie in [Lo, Hi] (integer bounds, also for floating point T)
+template <typename T, auto Lo, auto Hi>
+struct Range {
+    static_assert( Lo <= Hi, "empty ajs::Range" );
+    using value_type = T;
+    static constexpr T lo = static_cast<T>( Lo );
+    static constexpr T hi = static_cast<T>( Hi );
+    T value;
+    constexpr operator T() const { return value; }
+};
+
+// Specialize with a 'names' array of { "name", value } pairs to use an enum as a parameter
+template <typename E>
+struct EnumNames;
+
+namespace detail {
+
+template <typename T> struct IsRange : std::false_type {};
+template <typename T, auto Lo, auto Hi> struct IsRange<Range<T, Lo, Hi>> : std::true_type {};
+
+template <typename T> struct IsOptional : std::false_type {};
+template <typename T> struct IsOptional<std::optional<T>> : std::true_type {};
+
+template <typename T> inline constexpr bool unsupported = false;
+
+// Convert one argument, returns CLI_OK, CLI_ERRNO_BAD_FMT or CLI_ERRNO_OUT_OF_RANGE
+template <typename T>
+CliType_t parse( const char *s, T &out )
+{
+    if constexpr ( IsRange<T>::value ) {
+        typename T::value_type v{};
+        CliType_t err = parse( s, v );
+        if ( err != CLI_OK ) return err;
+        if ( v < T::lo || v > T::hi ) return CLI_ERRNO_OUT_OF_RANGE;
+        out.value = v;
+        return CLI_OK;
+    }
+    else if constexpr ( std::is_same_v<T, std::string_view> || std::is_same_v<T, const char *> ) {
+        out = s;
+        return CLI_OK;
+    }
+    else if constexpr ( std::is_same_v<T, bool> ) {
+        std::string_view v( s );
+        if ( v == "1" || v == "on" || v == "true" ) out = true;
+        else if ( v == "0" || v == "off" || v == "false" ) out = false;
+        else return CLI_ERRNO_BAD_FMT;
+        return CLI_OK;
+    }
+    else if constexpr ( std::is_enum_v<T> ) {
+        for ( const auto &name : EnumNames<T>::names ) {
+            if ( name.first == s ) {
+                out = name.second;
+                return CLI_OK;
+            }
+        }
+        return CLI_ERRNO_BAD_FMT;
+    }
+    else if constexpr ( std::is_floating_point_v<T> ) {
+        char *end;
+        errno = 0;
+        double v = std::strtod( s, &end );
+        if ( end == s || *end != CLI_CHAR_NULL ) return CLI_ERRNO_BAD_FMT;
+        if ( errno == ERANGE || v > std::numeric_limits<T>::max() || v < std::numeric_limits<T>::lowest() ) {
+            return CLI_ERRNO_OUT_OF_RANGE;
+        }
+        out = static_cast<T>( v );
+        return CLI_OK;
+    }
+    else if constexpr ( std::is_integral_v<T> && std::is_signed_v<T> ) {
+        char *end;
+        errno = 0;
+        long long v = std::strtoll( s, &end, 0 );
+        if ( end == s || *end != CLI_CHAR_NULL ) return CLI_ERRNO_BAD_FMT;
+        if ( errno == ERANGE || v < std::numeric_limits<T>::min() || v > std::numeric_limits<T>::max() ) {
+            return CLI_ERRNO_OUT_OF_RANGE;
+        }
+        out = static_cast<T>( v );
+        return CLI_OK;
+    }
+    else if constexpr ( std::is_integral_v<T> ) {
+        char *end;
+        if ( *s == '-' ) return CLI_ERRNO_OUT_OF_RANGE;
+        errno = 0;
+        unsigned long long v = std::strtoull( s, &end, 0 );
+        if ( end == s || *end != CLI_CHAR_NULL ) return CLI_ERRNO_BAD_FMT;
+        if ( errno == ERANGE || v > std::numeric_limits<T>::max() ) return CLI_ERRNO_OUT_OF_RANGE;
+        out = static_cast<T>( v );
+        return CLI_OK;
+    }
+    else {
+        static_assert( unsupported<T>, "unsupported ajs command parameter type" );
+        return CLI_ERRNO_BAD_FMT;
+    }
+}
+
+// Number of parameters before the first std::optional, which must all be trailing
+template <typename... Args>
+constexpr int requiredCount()
+{
+    constexpr bool optional[] = { IsOptional<Args>::value..., false };
+    int required = 0;
+    while ( required < (int) sizeof...(Args) && !optional[required] ) ++required;
+    for ( int i = required; i < (int) sizeof...(Args); i++ ) {
+        if ( !optional[i] ) return -1;
+    }
+    return required;
+}
+
+template <typename T>
+CliType_t parseArg( int index, int argc, char *argv[], T &out )
+{
+    if ( index >= argc ) return CLI_OK;     // Missing optional stays empty
+
+    CliType_t err;
+    if constexpr ( IsOptional<T>::value ) {
+        typename T::value_type v{};
+        err = parse( argv[index], v );
+        if ( err == CLI_OK ) out = v;
+    }
+    else {
+        err = parse( argv[index], out );
+    }
+    if ( err != CLI_OK ) {
+        cli_printf_err( "%sArgument %d \"%s\" is %s%s", CLI_NEWLINE, index, argv[index],
+            (err == CLI_ERRNO_OUT_OF_RANGE)? "out of range" : "not valid", CLI_NEWLINE );
+    }
+    return err;
+}
+
+// Generates the CliCommandFn_t for a typed handler
+template <auto Fn, typename Sig = decltype(Fn)>
+struct Binder;
+
+template <auto Fn, typename R, typename... Args>
+struct Binder<Fn, R (*)(Args...)> {
+    using Values = std::tuple<std::decay_t<Args>...>;
+    static constexpr int total = (int) sizeof...(Args);
+    static constexpr int required = requiredCount<std::decay_t<Args>...>();
+    static_assert( required >= 0, "std::optional parameters must come last" );
+
+    template <std::size_t... I>
+    static CliType_t parseAll( int argc, char *argv[], Values &values, std::index_sequence<I...> )
+    {
+        CliType_t err = CLI_OK;
+        (void) argc;
+        (void) argv;
+        ( (err = (err == CLI_OK)? parseArg( (int) I + 1, argc, argv, std::get<I>(values) ) : err), ... );
+        return err;
+    }
+
+    static CliType_t call( int argc, char *argv[] )
+    {
+        if ( argc - 1 < required || argc - 1 > total ) {
+            if ( required == total ) {
+                cli_printf_err( "%sExpected %d arguments%s", CLI_NEWLINE, total, CLI_NEWLINE );
+            }
+            else {
+                cli_printf_err( "%sExpected %d to %d arguments%s", CLI_NEWLINE, required, total, CLI_NEWLINE );
+            }
+            return CLI_ERRNO_BAD_FMT;
+        }
+
+        Values values{};
+        CliType_t err = parseAll( argc, argv, values, std::index_sequence_for<Args...>{} );
+        if ( err != CLI_OK ) return err;
+
+        if constexpr ( std::is_void_v<R> ) {
+            std::apply( Fn, values );
+            return CLI_OK;
+        }
+        else {
+            return static_cast<CliType_t>( std::apply( Fn, values ) );
+        }
+    }
+};
+
+// Not constexpr: reaching it makes commandTable fail to compile
+void duplicateCommandName();
+
+} // namespace detail
+
+// A command table in the order cli_addSortedList needs
+template <std::size_t N>
+struct CommandTable {
+    std::array<CliCommand_t, N> commands;
+};
+
+// One table entry; Fn is a function with typed parameters
+template <auto Fn>
+constexpr CliCommand_t command( const char *name, const char *usage, const char *help )
+{
+    return CliCommand_t{ name, usage, help, &detail::Binder<Fn>::call };
+}
+
+// Sort entries by name at compile time, duplicate names are a compile error
+template <typename... Commands>
+constexpr CommandTable<sizeof...(Commands)> commandTable( Commands... entries )
+{
+    CommandTable<sizeof...(Commands)> table{ { entries... } };
+    auto &c = table.commands;
+
+    for ( std::size_t i = 1; i < c.size(); i++ ) {
+        for ( std::size_t j = i; j > 0 && std::string_view( c[j].command ) < std::string_view( c[j - 1].command ); j-- ) {
+            CliCommand_t t = c[j];
+            c[j] = c[j - 1];
+            c[j - 1] = t;
+        }
+    }
+    for ( std::size_t i = 1; i < c.size(); i++ ) {
+        if ( std::string_view( c[i].command ) == std::string_view( c[i - 1].command ) ) {
+            detail::duplicateCommandName();
+        }
+    }
+    return table;
+}
+
+// Register a table; it must have static storage duration
+template <std::size_t N>
+inline CliType_t addList( const CommandTable<N> &table )
+{
+    return cli_addSortedList( table.commands.data(), (int) N );
+}
+
+// Swap a registered table for another, ex. when changing modes
+template <std::size_t N, std::size_t M>
+inline CliType_t replaceList( const CommandTable<N> &old, const CommandTable<M> &table )
+{
+    return cli_replaceList( old.commands.data(), table.commands.data(), (int) M );
+}
+
+template <std::size_t N>
+inline CliType_t removeList( const CommandTable<N> &table )
+{
+    return cli_removeList( table.commands.data() );
+}
+
+} // namespace ajs
+
+#endif /* AJS_CLI_HPP */
@@ -0,0 +1,133 @@
+/*
+ * cli_shm.c
+ * Author: aseidman
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cli_shm.h"
+
+#define RING_MASK       (CLI_SHM_RING_SIZE - 1)
+
+static CliShmSegment_t *prvMap( const char *name, int flags )
+{
+    int fd = shm_open( name, flags, 0600 );
+    if ( fd < 0 ) return NULL;
+
+    if ( (flags & O_CREAT) && ftruncate( fd, sizeof(CliShmSegment_t) ) != 0 ) {
+        close( fd );
+        return NULL;
+    }
+
+    void *p = mmap( NULL, sizeof(CliShmSegment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    return ( p == MAP_FAILED )? NULL : (CliShmSegment_t *) p;
+}
+
+CliShmSegment_t *cli_shm_create( const char *name )
+{
+    shm_unlink( name );
+    CliShmSegment_t *seg = prvMap( name, O_RDWR | O_CREAT | O_EXCL );
+    if ( seg == NULL ) return NULL;
+
+    atomic_init( &seg->in.head, 0 );
+    atomic_init( &seg->in.tail, 0 );
+    atomic_init( &seg->out.head, 0 );
+    atomic_init( &seg->out.tail, 0 );
+    atomic_thread_fence( memory_order_release );
+    seg->magic = CLI_SHM_MAGIC;
+    return seg;
+}
+
+CliShmSegment_t *cli_shm_open( const char *name )
+{
+    CliShmSegment_t *seg = prvMap( name, O_RDWR );
+    if ( seg != NULL && seg->magic != CLI_SHM_MAGIC ) {
+        cli_shm_close( seg );
+        return NULL;
+    }
+    return seg;
+}
+
+void cli_shm_close( CliShmSegment_t *seg )
+{
+    if ( seg != NULL ) {
+        munmap( seg, sizeof(CliShmSegment_t) );
+    }
+}
+
+void cli_shm_unlink( const char *name )
+{
+    shm_unlink( name );
+}
+
+/* ===== Ring Access ===== */
+size_t cli_shm_reserve( CliShmRing_t *ring, unsigned char **span )
+{
+    size_t head = atomic_load_explicit( &ring->head, memory_order_relaxed );
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_acquire );
+    size_t free = CLI_SHM_RING_SIZE - (head - tail);
+    size_t contiguous = CLI_SHM_RING_SIZE - (head & RING_MASK);
+
+    *span = &ring->data[head & RING_MASK];
+    return ( free < contiguous )? free : contiguous;
+}
+
+void cli_shm_commit( CliShmRing_t *ring, size_t n )
+{
+    size_t head = atomic_load_explicit( &ring->head, memory_order_relaxed );
+    atomic_store_explicit( &ring->head, head + n, memory_order_release );
+}
+
+size_t cli_shm_peek( CliShmRing_t *ring, const unsigned char **span )
+{
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    size_t head = atomic_load_explicit( &ring->head, memory_order_acquire );
+    size_t used = head - tail;
+    size_t contiguous = CLI_SHM_RING_SIZE - (tail & RING_MASK);
+
+    *span = &ring->data[tail & RING_MASK];
+    return ( used < contiguous )? used : contiguous;
+}
+
+void cli_shm_consume( CliShmRing_t *ring, size_t n )
+{
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+    atomic_store_explicit( &ring->tail, tail + n, memory_order_release );
+}
+
+size_t cli_shm_write( CliShmRing_t *ring, const void *buf, size_t len )
+{
+    const unsigned char *src = (const unsigned char *) buf;
+    size_t done = 0, n;
+    unsigned char *span;
+
+    // At most two spans when wrapping
+    while ( done < len && (n = cli_shm_reserve( ring, &span )) > 0 ) {
+        if ( n > len - done ) n = len - done;
+        memcpy( span, src + done, n );
+        cli_shm_commit( ring, n );
+        done += n;
+    }
+    return done;
+}
+
+size_t cli_shm_read( CliShmRing_t *ring, void *buf, size_t len )
+{
+    unsigned char *dst = (unsigned char *) buf;
+    size_t done = 0, n;
+    const unsigned char *span;
+
+    while ( done < len && (n = cli_shm_peek( ring, &span )) > 0 ) {
+        if ( n > len - done ) n = len - done;
+        memcpy( dst + done, span, n );
+        cli_shm_consume( ring, n );
+        done += n;
+    }
+    return done;
+}
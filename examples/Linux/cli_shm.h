@@ -0,0 +1,62 @@
+/*
+ * cli_shm.h
+ * Author: aseidman
+ *
+ * Shared memory transport for running AJScli in a host simulator.
+ * Two single producer / single consumer rings live in one POSIX shared
+ * memory segment: 'in' carries bytes to the CLI, 'out' carries its output.
+ * Steady state transfers are plain loads/stores, no syscalls.
+ */
+
+#ifndef CLI_SHM_H
+#define CLI_SHM_H
+
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#include "AJScli.h"
+
+#ifndef CLI_SHM_RING_SIZE
+#define CLI_SHM_RING_SIZE       (1 << 16)   // Must be a power of two
+#endif
+
+#ifndef CLI_SHM_SPIN_LIMIT
+#define CLI_SHM_SPIN_LIMIT      (1 << 12)   // Empty polls before the CLI side naps
+#endif
+
+#define CLI_SHM_CACHE_LINE      (64)
+#define CLI_SHM_MAGIC           (0x414A5343UL)
+
+typedef struct {
+    _Alignas(CLI_SHM_CACHE_LINE) atomic_size_t head;    // Written by producer only
+    _Alignas(CLI_SHM_CACHE_LINE) atomic_size_t tail;    // Written by consumer only
+    _Alignas(CLI_SHM_CACHE_LINE) unsigned char data[CLI_SHM_RING_SIZE];
+} CliShmRing_t;
+
+typedef struct {
+    unsigned long magic;
+    CliShmRing_t in;
+    CliShmRing_t out;
+} CliShmSegment_t;
+
+/* Segment management */
+CliShmSegment_t *cli_shm_create( const char *name );
+CliShmSegment_t *cli_shm_open( const char *name );
+void cli_shm_close( CliShmSegment_t *seg );
+void cli_shm_unlink( const char *name );
+
+/* Connect the CLI to seg->in / seg->out through cli_setOps */
+CliType_t cli_shm_attach( CliShmSegment_t *seg );
+
+/* Zero copy access: reserve/peek a contiguous span, then commit/consume it */
+size_t cli_shm_reserve( CliShmRing_t *ring, unsigned char **span );
+void cli_shm_commit( CliShmRing_t *ring, size_t n );
+size_t cli_shm_peek( CliShmRing_t *ring, const unsigned char **span );
+void cli_shm_consume( CliShmRing_t *ring, size_t n );
+
+/* Copying helpers, return bytes transferred (never block) */
+size_t cli_shm_write( CliShmRing_t *ring, const void *buf, size_t len );
+size_t cli_shm_read( CliShmRing_t *ring, void *buf, size_t len );
+
+#endif /* CLI_SHM_H */
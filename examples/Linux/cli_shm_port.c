@@ -0,0 +1,67 @@
+/*
+ * cli_shm_port.c
+ * Author: aseidman
+ *
+ * CLI side of the shared memory transport (simulator only).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include "cli_shm.h"
+
+#define RING_MASK       (CLI_SHM_RING_SIZE - 1)
+
+static CliShmSegment_t *attached = NULL;
+
+// Non-blocking; -1 lets cli_task run its timeouts. Naps only when idle.
+static int prvShmGetChar( void )
+{
+    static unsigned int idle = 0;
+    CliShmRing_t *ring = &attached->in;
+    size_t tail = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+
+    if ( tail == atomic_load_explicit( &ring->head, memory_order_acquire ) ) {
+        if ( ++idle >= CLI_SHM_SPIN_LIMIT ) {
+            struct timespec nap = { 0, 50000 };
+            nanosleep( &nap, NULL );
+        }
+        return -1;
+    }
+
+    idle = 0;
+    int c = ring->data[tail & RING_MASK];
+    atomic_store_explicit( &ring->tail, tail + 1, memory_order_release );
+    return c;
+}
+
+// Spins while the driver drains a full ring
+static void prvShmPutChar( int c )
+{
+    CliShmRing_t *ring = &attached->out;
+    size_t head = atomic_load_explicit( &ring->head, memory_order_relaxed );
+
+    while ( head - atomic_load_explicit( &ring->tail, memory_order_acquire ) >= CLI_SHM_RING_SIZE );
+
+    ring->data[head & RING_MASK] = (unsigned char) c;
+    atomic_store_explicit( &ring->head, head + 1, memory_order_release );
+}
+
+// Whole lines at a time from cli_printf and md
+static void prvShmWrite( const char *data, int len )
+{
+    size_t done = 0;
+
+    while ( done < (size_t) len ) {
+        done += cli_shm_write( &attached->out, data + done, len - done );
+    }
+}
+
+CliType_t cli_shm_attach( CliShmSegment_t *seg )
+{
+    if ( seg == NULL ) return CLI_ERRNO_NULL_PTR;
+    attached = seg;
+    cli_setWriteOp( prvShmWrite );
+    return cli_setOps( prvShmGetChar, prvShmPutChar );
+}
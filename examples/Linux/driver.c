@@ -0,0 +1,120 @@
+/*
+ * driver.c
+ * Author: aseidman
+ *
+ * Test driver: streams command lines from stdin into the simulator and
+ * copies its output to stdout. Each command is complete once a fresh
+ * prompt arrives, so many lines can be in flight at once. Gives up when
+ * the simulator goes quiet (e.g. after 'exit').
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cli_shm.h"
+
+#define DRIVER_IDLE_SEC     (1.0)
+
+static const char prompt[] = CLI_PROMPT " ";
+
+static double nowSec( void )
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Count prompts in output, matching across span boundaries
+static size_t countPrompts( const unsigned char *p, size_t n, size_t *match )
+{
+    size_t found = 0, i;
+    for ( i = 0; i < n; i++ ) {
+        if ( p[i] == (unsigned char) prompt[*match] ) {
+            if ( ++(*match) == sizeof(prompt) - 1 ) {
+                ++found;
+                *match = 0;
+            }
+        }
+        else {
+            *match = ( p[i] == (unsigned char) prompt[0] )? 1 : 0;
+        }
+    }
+    return found;
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *name = ( argc > 1 )? argv[1] : "/ajscli";
+    CliShmSegment_t *seg = NULL;
+    double start = nowSec();
+
+    // Simulator may still be starting
+    while ( (seg = cli_shm_open( name )) == NULL ) {
+        if ( nowSec() - start > 5.0 ) {
+            fprintf( stderr, "could not open %s\n", name );
+            return 1;
+        }
+    }
+
+    // Read all input up front so stdin never stalls the stream
+    size_t cap = 1 << 16, len = 0, n;
+    char *input = malloc( cap ), *grown;
+    if ( input == NULL ) {
+        fprintf( stderr, "out of memory\n" );
+        cli_shm_close( seg );
+        return 1;
+    }
+    while ( (n = fread( input + len, 1, cap - len, stdin )) > 0 ) {
+        len += n;
+        if ( len < cap ) continue;
+        // Keep the old buffer until the bigger one exists
+        if ( (grown = realloc( input, cap * 2 )) == NULL ) {
+            fprintf( stderr, "out of memory reading %zu bytes of input\n", len );
+            free( input );
+            cli_shm_close( seg );
+            return 1;
+        }
+        input = grown;
+        cap *= 2;
+    }
+
+    size_t lines = 0, i;
+    for ( i = 0; i < len; i++ ) {
+        if ( input[i] == '\n' ) {
+            input[i] = CLI_CHAR_RETURN;
+            ++lines;
+        }
+    }
+
+    // One prompt per line, plus the initial prompt if nobody has read it yet
+    size_t expected = lines + ( atomic_load( &seg->out.tail ) == 0 );
+    size_t sent = 0, prompts = 0, match = 0;
+    const unsigned char *span;
+    double last = start = nowSec();
+    while ( prompts < expected ) {
+        if ( sent < len ) {
+            sent += cli_shm_write( &seg->in, input + sent, len - sent );
+        }
+        if ( (n = cli_shm_peek( &seg->out, &span )) > 0 ) {
+            prompts += countPrompts( span, n, &match );
+            fwrite( span, 1, n, stdout );
+            cli_shm_consume( &seg->out, n );
+            last = nowSec();
+        }
+        else if ( nowSec() - last > DRIVER_IDLE_SEC ) {
+            break;
+        }
+    }
+    double elapsed = nowSec() - start;
+
+    fflush( stdout );
+    fprintf( stderr, "%zu commands in %.3f s (%.0f commands/s)\n",
+        lines, elapsed, lines / (elapsed > 0? elapsed : 1e-9) );
+    free( input );
+    cli_shm_close( seg );
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * main.c
+ * Author: aseidman
+ *
+ * Host simulator: runs cli_task on the shared memory transport.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cli_shm.h"
+
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(x)    (sizeof(x)/sizeof((x)[0]))
+#endif
+
+static const char *shmName = "/ajscli";
+
+#if CLI_HAS_RECORD
+static void prvRecord( void *ctx, const unsigned char *data, int len )
+{
+    // Flushed as it goes so a killed simulator still leaves a usable file
+    fwrite( data, 1, len, (FILE *) ctx );
+    fflush( (FILE *) ctx );
+}
+#endif
+
+static unsigned long tickMs( void )
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return (unsigned long) t.tv_sec * 1000UL + (unsigned long) (t.tv_nsec / 1000000L);
+}
+
+static CliType_t prvCommandPrint( int argc, char *argv[] )
+{
+    int i = 0;
+    while ( i++ < (argc-1) ) {
+        cli_printf( "%s%s", argv[i], (i == argc-1)? "\r\n" : " " );
+    }
+
+    return CLI_OK;
+}
+
+static CliType_t prvExit( int argc, char *argv[] )
+{
+    (void) argc;
+    (void) argv;
+    cli_printf( "Goodbye!\r\n" );
+#if CLI_HAS_RECORD
+    cli_setRecordOp( NULL, NULL );
+#endif
+    cli_shm_unlink( shmName );
+    exit( 0 );
+}
+
+#if CLI_HAS_XFER
+// rx/tx storage: files in the working directory
+static FILE *xferFile = NULL;
+
+static CliType_t prvXferOpen( void *ctx, const char *name, unsigned long *size, int writing )
+{
+    (void) ctx;
+    if ( strchr( name, '/' ) != NULL ) return CLI_ERRNO_BAD_FMT;
+    xferFile = fopen( name, writing? "wb" : "rb" );
+    if ( xferFile == NULL ) return CLI_ERRNO_FAULT;
+    if ( !writing ) {
+        fseek( xferFile, 0, SEEK_END );
+        *size = (unsigned long) ftell( xferFile );
+    }
+    return CLI_OK;
+}
+
+static int prvXferRead( void *ctx, unsigned long offset, char *data, int len )
+{
+    (void) ctx;
+    if ( fseek( xferFile, (long) offset, SEEK_SET ) != 0 ) return -1;
+    return (int) fread( data, 1, len, xferFile );
+}
+
+static int prvXferWrite( void *ctx, unsigned long offset, const char *data, int len )
+{
+    (void) ctx;
+    if ( fseek( xferFile, (long) offset, SEEK_SET ) != 0 ) return -1;
+    return (int) fwrite( data, 1, len, xferFile );
+}
+
+static void prvXferClose( void *ctx, CliType_t status )
+{
+    (void) ctx;
+    (void) status;
+    fclose( xferFile );
+    xferFile = NULL;
+}
+
+static const CliXferOps_t xferOps = {
+    .open = prvXferOpen,
+    .read = prvXferRead,
+    .write = prvXferWrite,
+    .close = prvXferClose,
+};
+#endif
+
+static CliCommand_t cmdList[] = {
+    {
+        .command = "echo",
+        .usage = "<text>",
+        .help = "Echo arguments",
+        .fn = &prvCommandPrint,
+    },
+    {
+        .command = "exit",
+        .usage = "",
+        .help = "Exit simulator",
+        .fn = &prvExit,
+    },
+};
+
+int main( int argc, char *argv[] )
+{
+    if ( argc > 1 ) shmName = argv[1];
+#if CLI_HAS_RECORD
+    // sim <name> <session.rec> records everything for ./replay
+    FILE *record = ( argc > 2 )? fopen( argv[2], "wb" ) : NULL;
+    if ( argc > 2 && record == NULL ) {
+        perror( argv[2] );
+        return 1;
+    }
+#endif
+
+    CliShmSegment_t *seg = cli_shm_create( shmName );
+    if ( seg == NULL ) {
+        perror( "cli_shm_create" );
+        return 1;
+    }
+
+    cli_init();
+    cli_addList( cmdList, ARRAYSIZE(cmdList) );
+    cli_setTickOp( tickMs );
+    cli_shm_attach( seg );
+#if CLI_HAS_XFER
+    cli_setXferOps( &xferOps );
+#endif
+#if CLI_HAS_RECORD
+    if ( record != NULL ) cli_setRecordOp( prvRecord, record );
+#endif
+
+    cli_task( NULL );
+
+    return -1; // Should not get here
+}
@@ -0,0 +1,218 @@
+/*
+ * replay.c
+ * Author: aseidman
+ *
+ * Plays a session recorded with cli_setRecordOp (sim built with
+ * -DCLI_HAS_RECORD=1, started as 'sim <name> session.rec') into a fresh
+ * simulator. Input goes in at the recorded pace, or as fast as possible
+ * with -f. Output is checked byte for byte, and echo latency (input byte
+ * to next output) is reported for the recording and the replay.
+ *
+ *     replay [-f] session.rec [name]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cli_shm.h"
+
+#define REPLAY_IDLE_SEC     (1.0)
+
+typedef struct {
+    double *v;
+    size_t n, cap;
+} Samples_t;
+
+static double nowSec( void )
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// realloc that gives up on the replay instead of losing the old buffer
+static void *growOrExit( void *p, size_t size )
+{
+    void *grown = realloc( p, size );
+    if ( grown == NULL ) {
+        fprintf( stderr, "out of memory (%zu bytes)\n", size );
+        exit( 1 );
+    }
+    return grown;
+}
+
+static void addSample( Samples_t *s, double v )
+{
+    if ( s->n == s->cap ) {
+        s->cap = s->cap? s->cap * 2 : 256;
+        s->v = growOrExit( s->v, s->cap * sizeof(double) );
+    }
+    s->v[s->n++] = v;
+}
+
+static int cmpDouble( const void *a, const void *b )
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void report( const char *label, Samples_t *s )
+{
+    double sum = 0;
+    size_t i;
+
+    if ( s->n == 0 ) {
+        printf( "%-9s no echo samples\n", label );
+        return;
+    }
+    qsort( s->v, s->n, sizeof(double), cmpDouble );
+    for ( i = 0; i < s->n; i++ ) sum += s->v[i];
+    printf( "%-9s echo latency: %zu samples, avg %.3f ms, p50 %.3f ms, p95 %.3f ms, max %.3f ms\n",
+        label, s->n, 1e3 * sum / s->n, 1e3 * s->v[s->n / 2], 1e3 * s->v[(s->n * 95) / 100], 1e3 * s->v[s->n - 1] );
+}
+
+static unsigned long getVarint( const unsigned char *buf, size_t len, size_t *pos )
+{
+    unsigned long v = 0;
+    int shift = 0;
+    while ( *pos < len ) {
+        unsigned char b = buf[(*pos)++];
+        v |= (unsigned long) (b & 0x7F) << shift;
+        if ( !(b & 0x80) ) return v;
+        shift += 7;
+    }
+    fprintf( stderr, "recording truncated\n" );
+    exit( 1 );
+}
+
+int main( int argc, char *argv[] )
+{
+    int fast = 0, arg = 1;
+    if ( argc > 1 && 0 == strcmp( argv[1], "-f" ) ) {
+        fast = 1;
+        ++arg;
+    }
+    if ( arg >= argc ) {
+        fprintf( stderr, "usage: %s [-f] session.rec [name]\n", argv[0] );
+        return 1;
+    }
+    const char *name = ( arg + 1 < argc )? argv[arg + 1] : "/ajscli";
+
+    // Load the recording
+    FILE *f = fopen( argv[arg], "rb" );
+    if ( f == NULL ) {
+        perror( argv[arg] );
+        return 1;
+    }
+    size_t cap = 1 << 16, len = 0, n;
+    unsigned char *rec = growOrExit( NULL, cap );
+    while ( (n = fread( rec + len, 1, cap - len, f )) > 0 ) {
+        len += n;
+        if ( len == cap ) rec = growOrExit( rec, cap *= 2 );
+    }
+    fclose( f );
+
+    size_t magic = sizeof(CLI_RECORD_MAGIC) - 1, pos = magic + 1;
+    if ( len <= magic || memcmp( rec, CLI_RECORD_MAGIC, magic ) || rec[magic] != CLI_RECORD_VERSION ) {
+        fprintf( stderr, "%s: not a version %d recording\n", argv[arg], CLI_RECORD_VERSION );
+        return 1;
+    }
+    double tickSec = 1.0 / (double) getVarint( rec, len, &pos );
+
+    // Split into timed input bytes and the expected output stream
+    unsigned char *input = growOrExit( NULL, len ), *expected = growOrExit( NULL, len );
+    double *inputAt = growOrExit( NULL, len * sizeof(double) );
+    size_t inputs = 0, outLen = 0;
+    Samples_t recorded = { 0 }, replayed = { 0 };
+    double t = 0;
+    int awaitingEcho = 0;
+
+    while ( pos < len ) {
+        int type = rec[pos++];
+        t += getVarint( rec, len, &pos ) * tickSec;
+        if ( type == CLI_RECORD_EV_IN && pos < len ) {
+            inputAt[inputs] = t;
+            input[inputs++] = rec[pos++];
+            awaitingEcho = 1;
+        }
+        else if ( type == CLI_RECORD_EV_OUT ) {
+            size_t count = getVarint( rec, len, &pos );
+            if ( pos + count > len ) count = len - pos;
+            memcpy( expected + outLen, rec + pos, count );
+            outLen += count;
+            pos += count;
+            if ( awaitingEcho ) {
+                addSample( &recorded, t - inputAt[inputs - 1] );
+                awaitingEcho = 0;
+            }
+        }
+        else {
+            fprintf( stderr, "bad record type %d\n", type );
+            return 1;
+        }
+    }
+
+    // Attach to the simulator, which may still be starting
+    CliShmSegment_t *seg = NULL;
+    double start = nowSec();
+    while ( (seg = cli_shm_open( name )) == NULL ) {
+        if ( nowSec() - start > 5.0 ) {
+            fprintf( stderr, "could not open %s\n", name );
+            return 1;
+        }
+    }
+
+    unsigned char *got = growOrExit( NULL, outLen + CLI_SHM_RING_SIZE );
+    size_t gotLen = 0, sent = 0;
+    const unsigned char *span;
+    double sentAt = 0, last;
+    awaitingEcho = 0;
+    start = last = nowSec();
+
+    while ( gotLen < outLen || sent < inputs ) {
+        double now = nowSec();
+        if ( sent < inputs && (fast || now - start >= inputAt[sent] - inputAt[0]) &&
+             cli_shm_write( &seg->in, &input[sent], 1 ) == 1 ) {
+            ++sent;
+            sentAt = now;
+            awaitingEcho = 1;
+        }
+        if ( (n = cli_shm_peek( &seg->out, &span )) > 0 ) {
+            if ( awaitingEcho ) {
+                addSample( &replayed, nowSec() - sentAt );
+                awaitingEcho = 0;
+            }
+            if ( gotLen + n > outLen + CLI_SHM_RING_SIZE ) n = outLen + CLI_SHM_RING_SIZE - gotLen;
+            memcpy( got + gotLen, span, n );
+            gotLen += n;
+            cli_shm_consume( &seg->out, n );
+            last = nowSec();
+        }
+        else if ( sent == inputs && nowSec() - last > REPLAY_IDLE_SEC ) {
+            break;
+        }
+    }
+    double elapsed = nowSec() - start;
+    cli_shm_close( seg );
+
+    // Compare output
+    size_t same = 0;
+    while ( same < outLen && same < gotLen && expected[same] == got[same] ) ++same;
+
+    printf( "replayed %zu input bytes in %.3f s (recorded %.3f s)%s\n",
+        inputs, elapsed, inputs? inputAt[inputs - 1] - inputAt[0] : 0.0, fast? ", fast" : "" );
+    printf( "output:   recorded %zu bytes, replayed %zu bytes, delta %+ld\n", outLen, gotLen, (long) gotLen - (long) outLen );
+    report( "recorded", &recorded );
+    report( "replayed", &replayed );
+
+    if ( same == outLen && same == gotLen ) {
+        printf( "output identical\n" );
+        return 0;
+    }
+    printf( "output differs at byte %zu\n", same );
+    return 2;
+}
@@ -12,6 +12,7 @@
 #define CLI_HAS_INSERT_MODE         (1)
 #define CLI_INIT_TEXT               CLI_NEWLINE
 #define CLI_RTOS_TASK_DELETE        (1)
+#define CLI_TICKS_PER_SEC           (configTICK_RATE_HZ)
 
 #define CLI_INIT(getChar, putChar)                  \
     do {                                            \
@@ -3,6 +3,8 @@
  * Author: aseidman
  */
 
+#include <string.h>
+
 #include "project.h"
 #include "shell.h"
 #include "usbd_cdc_if.h"
@@ -12,7 +14,9 @@ extern QueueHandle_t rxCharsQueueHandle;
 extern USBD_HandleTypeDef hUsbDeviceFS;
 
 static void sendByte( int byte );
+static void sendBytes( const char *data, int len );
 static int recvByte( void );
+static unsigned long tickMs( void );
 static void ctrlC( void *arg );
 
 static CliType_t pongCommand( int argc, char *argv[] );
@@ -30,23 +34,54 @@ void shell_init( void ) {
     cli_init();
     cli_setCtrlCOp( ctrlC, NULL );
     cli_addList( defaultCommands, ARRAYSIZE(defaultCommands) );
+    cli_setTickOp( tickMs );
+    cli_setWriteOp( sendBytes );
     cli_setOps( recvByte, sendByte );
 }
 
 static void sendByte( int byte ) {
-    uint8_t val = (uint8_t) byte;
-    while ( hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED ||
-            CDC_Transmit_FS( &val, 1 ) != USBD_OK ) {
-        vTaskDelay(1);
+    char c = (char) byte;
+    sendBytes( &c, 1 );
+}
+
+// CDC_Transmit_FS only starts the transfer, so the data has to outlive the
+// call. It is copied here, and the buffer is only reused once TxState is idle.
+static uint8_t txBuf[256];
+
+static int txIdle( void ) {
+    USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef *) hUsbDeviceFS.pClassData;
+    return hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED && hcdc != NULL && hcdc->TxState == 0;
+}
+
+static void sendBytes( const char *data, int len ) {
+    while ( len > 0 ) {
+        uint16_t n = (len < (int) sizeof(txBuf))? (uint16_t) len : (uint16_t) sizeof(txBuf);
+        while ( !txIdle() ) {
+            vTaskDelay(1);
+        }
+        memcpy( txBuf, data, n );
+        if ( CDC_Transmit_FS( txBuf, n ) != USBD_OK ) {
+            vTaskDelay(1);
+            continue;
+        }
+        data += n;
+        len -= n;
     }
 }
 
 static int recvByte( void ) {
     uint8_t val;
-    xQueueReceive( rxCharsQueueHandle, &val, portMAX_DELAY );
+    // Time out so the CLI can resolve a lone ESC key press
+    if ( xQueueReceive( rxCharsQueueHandle, &val, pdMS_TO_TICKS(10) ) != pdTRUE ) {
+        return -1;
+    }
     return (int) val;
 }
 
+static unsigned long tickMs( void ) {
+    return (unsigned long) xTaskGetTickCount();
+}
+
 static void ctrlC( void *arg ) {
     PROJ_UNUSED( arg );
     cli_printf("\r\033[2K<CTRL-C> Rebooting.... ");
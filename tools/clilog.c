@@ -0,0 +1,259 @@
+/*******************************************************************
+
+                Adam Seidman CLI Binary Log Decoder
+
+********************************************************************
+
+ File Name:             clilog.c
+ Compiler:              ANSI C (host)
+ Author:                Adam Seidman
+ License:               MIT
+
+ Copies a console stream to stdout, replacing cli_log frames with
+ text formatted from the format strings in the firmware ELF.
+
+    clilog firmware.elf [capture.bin]   (reads stdin by default)
+
+*******************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "AJScli.h"
+
+static const char *levelNames[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR" };
+
+static unsigned char *fmtSection;
+static unsigned long fmtSize;
+
+static unsigned long rd( const unsigned char *p, int bytes )
+{
+    unsigned long v = 0;
+    while ( bytes-- ) v = (v << 8) | p[bytes];
+    return v;
+}
+
+// Load the format string section from a little endian ELF32/ELF64 file
+static void loadElf( const char *path )
+{
+    FILE *f = fopen( path, "rb" );
+    if ( f == NULL ) {
+        perror( path );
+        exit( 1 );
+    }
+    fseek( f, 0, SEEK_END );
+    long size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    unsigned char *elf = malloc( size );
+    if ( elf == NULL || fread( elf, 1, size, f ) != (size_t) size ) {
+        perror( path );
+        exit( 1 );
+    }
+    fclose( f );
+
+    if ( size < 52 || memcmp( elf, "\177ELF", 4 ) || elf[5] != 1 ) {
+        fprintf( stderr, "%s: not a little endian ELF file\n", path );
+        exit( 1 );
+    }
+    int is64 = ( elf[4] == 2 );
+    unsigned long shoff = is64? rd( elf + 0x28, 8 ) : rd( elf + 0x20, 4 );
+    int shentsize = (int) rd( elf + (is64? 0x3A : 0x2E), 2 );
+    int shnum = (int) rd( elf + (is64? 0x3C : 0x30), 2 );
+    int shstrndx = (int) rd( elf + (is64? 0x3E : 0x32), 2 );
+
+    #define SH(i)           (elf + shoff + (unsigned long) (i) * shentsize)
+    #define SH_OFFSET(h)    (is64? rd( (h) + 0x18, 8 ) : rd( (h) + 0x10, 4 ))
+    #define SH_SIZE(h)      (is64? rd( (h) + 0x20, 8 ) : rd( (h) + 0x14, 4 ))
+    const char *names = (const char *) elf + SH_OFFSET( SH(shstrndx) );
+    int i;
+    for ( i = 0; i < shnum; i++ ) {
+        const unsigned char *h = SH( i );
+        if ( 0 == strcmp( names + rd(h, 4), CLI_LOG_SECTION ) ) {
+            fmtSection = elf + SH_OFFSET( h );
+            fmtSize = SH_SIZE( h );
+            return;
+        }
+    }
+    fprintf( stderr, "%s: no %s section\n", path, CLI_LOG_SECTION );
+    exit( 1 );
+}
+
+typedef struct {
+    int tag;
+    unsigned long long u;
+    double f;
+    char s[256];
+} Arg_t;
+
+static int readVarint( const unsigned char *p, int len, int *pos, unsigned long long *v )
+{
+    int shift = 0;
+    *v = 0;
+    while ( *pos < len ) {
+        unsigned char b = p[(*pos)++];
+        *v |= (unsigned long long) (b & 0x7F) << shift;
+        if ( !(b & 0x80) ) return 0;
+        shift += 7;
+    }
+    return -1;
+}
+
+static int parseArgs( const unsigned char *p, int len, Arg_t *args, int max )
+{
+    int pos = 5, count = 0, j;
+    while ( pos < len && count < max ) {
+        Arg_t *a = &args[count];
+        a->tag = p[pos++];
+        switch ( a->tag ) {
+        case CLI_LOG_TAG_INT:
+            if ( readVarint( p, len, &pos, &a->u ) ) return count;
+            a->u = (a->u >> 1) ^ (unsigned long long) -(long long) (a->u & 1);
+            break;
+        case CLI_LOG_TAG_UINT:
+        case CLI_LOG_TAG_POINTER:
+            if ( readVarint( p, len, &pos, &a->u ) ) return count;
+            break;
+        case CLI_LOG_TAG_DOUBLE: {
+            unsigned long long bits = 0;
+            if ( pos + 8 > len ) return count;
+            for ( j = 0; j < 8; j++ ) bits |= (unsigned long long) p[pos++] << (8 * j);
+            memcpy( &a->f, &bits, sizeof(a->f) );
+            break;
+        }
+        case CLI_LOG_TAG_STRING:
+            if ( pos >= len || pos + 1 + p[pos] > len ) return count;
+            memcpy( a->s, p + pos + 1, p[pos] );
+            a->s[p[pos]] = 0;
+            pos += 1 + p[pos];
+            break;
+        default:
+            return count;
+        }
+        ++count;
+    }
+    return count;
+}
+
+// printf the format string on the host, one conversion at a time
+static void render( const char *fmt, Arg_t *args, int count )
+{
+    char spec[64];
+    int next = 0;
+
+    while ( *fmt ) {
+        if ( *fmt != '%' ) {
+            putchar( *(fmt++) );
+            continue;
+        }
+        if ( fmt[1] == '%' ) {
+            putchar( '%' );
+            fmt += 2;
+            continue;
+        }
+
+        // Copy flags, width and precision; drop length modifiers
+        int n = 0;
+        spec[n++] = *(fmt++);
+        while ( *fmt && strchr( "-+ #0123456789.*", *fmt ) && n < 40 ) {
+            if ( *fmt == '*' ) {
+                n += snprintf( spec + n, sizeof(spec) - n, "%d", (next < count)? (int) args[next++].u : 0 );
+                ++fmt;
+            }
+            else {
+                spec[n++] = *(fmt++);
+            }
+        }
+        while ( *fmt && strchr( "hljztL", *fmt ) ) ++fmt;
+        char conv = *fmt;
+        if ( conv == 0 ) break;
+        ++fmt;
+
+        if ( next >= count ) {
+            printf( "<missing>" );
+            continue;
+        }
+        Arg_t *a = &args[next++];
+        if ( strchr( "diuoxXc", conv ) ) {
+            if ( conv == 'c' ) {
+                spec[n++] = 'c';
+                spec[n] = 0;
+                printf( spec, (int) a->u );
+            }
+            else {
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = 0;
+                printf( spec, a->u );
+            }
+        }
+        else if ( strchr( "fFeEgGaA", conv ) ) {
+            spec[n++] = conv;
+            spec[n] = 0;
+            printf( spec, (a->tag == CLI_LOG_TAG_DOUBLE)? a->f : (double) (long long) a->u );
+        }
+        else if ( conv == 's' ) {
+            spec[n++] = 's';
+            spec[n] = 0;
+            printf( spec, (a->tag == CLI_LOG_TAG_STRING)? a->s : "<bad>" );
+        }
+        else if ( conv == 'p' ) {
+            printf( "0x%llx", a->u );
+        }
+        else {
+            printf( "<%%%c>", conv );
+        }
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    if ( argc < 2 ) {
+        fprintf( stderr, "usage: %s firmware.elf [capture.bin]\n", argv[0] );
+        return 1;
+    }
+    loadElf( argv[1] );
+    FILE *in = (argc > 2)? fopen( argv[2], "rb" ) : stdin;
+    if ( in == NULL ) {
+        perror( argv[2] );
+        return 1;
+    }
+
+    unsigned char frame[256];
+    Arg_t args[16];
+    int c;
+
+    while ( (c = getc(in)) != EOF ) {
+        if ( c != CLI_LOG_FRAME_START ) {
+            putchar( c );
+            if ( c == '\n' ) fflush( stdout );
+            continue;
+        }
+        int type = getc( in );
+        if ( type != CLI_LOG_FRAME_TYPE ) {
+            // Some other frame (e.g. trace dump), pass it through
+            putchar( c );
+            if ( type != EOF ) putchar( type );
+            continue;
+        }
+        int len = getc( in );
+        if ( len == EOF || len < 5 || fread( frame, 1, len, in ) != (size_t) len ) break;
+
+        int level = frame[0];
+        unsigned long id = rd( frame + 1, 4 );
+        int count = parseArgs( frame, len, args, 16 );
+
+        printf( "\r\n[%s] ", (level < 5)? levelNames[level] : "?" );
+        if ( id < fmtSize ) {
+            render( (const char *) fmtSection + id, args, count );
+        }
+        else {
+            printf( "<unknown format id %lu>", id );
+        }
+        printf( "\r\n" );
+        fflush( stdout );
+    }
+    return 0;
+}
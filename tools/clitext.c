@@ -0,0 +1,379 @@
+/*******************************************************************
+
+                Adam Seidman CLI Packed Text Generator
+
+********************************************************************
+
+ File Name:             clitext.c
+ Compiler:              ANSI C (host)
+ Author:                Adam Seidman
+ License:               MIT
+
+ Scans sources for CLI_TEXT(ID, "text") and writes AJScliText.h:
+ one reference macro per ID plus a single dictionary compressed blob.
+
+    clitext [-o AJScliText.h] file.c [file.c ...]
+
+*******************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_TEXTS           (4096)
+#define MAX_ID              (64)
+#define MAX_DICT            (128)
+#define MIN_ENTRY           (2)
+#define MAX_ENTRY           (24)
+#define HASH_SIZE           (1 << 20)
+
+typedef struct {
+    char id[MAX_ID];
+    unsigned char *raw;             // decoded text
+    int rawLen;
+    int *sym;                       // < 0x80 literal, >= 0x80 dictionary entry
+    int symLen;
+    long offset;                    // offset of packed text within blob
+    int dup;                        // index of identical text, or -1
+} Text_t;
+
+typedef struct {
+    const int *p;
+    int len;
+    int count;
+} Candidate_t;
+
+static Text_t texts[MAX_TEXTS];
+static int textCount = 0;
+
+static unsigned char dict[MAX_DICT][MAX_ENTRY];
+static int dictLen[MAX_DICT];
+static int dictCount = 0;
+
+static Candidate_t *table;
+
+static void fail( const char *file, int line, const char *msg )
+{
+    fprintf( stderr, "%s:%d: %s\n", file, line, msg );
+    exit( 1 );
+}
+
+static char *readFile( const char *path )
+{
+    FILE *f = fopen( path, "rb" );
+    if ( f == NULL ) {
+        perror( path );
+        exit( 1 );
+    }
+    fseek( f, 0, SEEK_END );
+    long len = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    char *buf = malloc( len + 1 );
+    if ( buf == NULL || fread( buf, 1, len, f ) != (size_t) len ) {
+        perror( path );
+        exit( 1 );
+    }
+    buf[len] = 0;
+    fclose( f );
+    return buf;
+}
+
+static int lineOf( const char *start, const char *p )
+{
+    int line = 1;
+    while ( start < p ) {
+        if ( *(start++) == '\n' ) ++line;
+    }
+    return line;
+}
+
+static const char *skipSpace( const char *p )
+{
+    while ( isspace((unsigned char) *p) ) ++p;
+    return p;
+}
+
+// Decode one C string literal starting at the opening quote, appending to out
+static const char *parseLiteral( const char *p, unsigned char *out, int *len,
+                                 const char *file, const char *src )
+{
+    int v, n;
+    ++p;
+    while ( *p != '"' ) {
+        if ( *p == 0 || *p == '\n' ) fail( file, lineOf(src, p), "unterminated string" );
+        if ( *p != '\\' ) {
+            out[(*len)++] = (unsigned char) *(p++);
+            continue;
+        }
+        ++p;
+        switch ( *p ) {
+        case 'n':  v = '\n'; ++p; break;
+        case 'r':  v = '\r'; ++p; break;
+        case 't':  v = '\t'; ++p; break;
+        case 'a':  v = '\a'; ++p; break;
+        case 'b':  v = '\b'; ++p; break;
+        case 'f':  v = '\f'; ++p; break;
+        case 'v':  v = '\v'; ++p; break;
+        case 'e':  v = 0x1B; ++p; break;
+        case 'x':
+            ++p;
+            for ( v = 0, n = 0; isxdigit((unsigned char) *p); n++, p++ ) {
+                v = v * 16 + (isdigit((unsigned char) *p)? *p - '0' : (tolower((unsigned char) *p) - 'a' + 10));
+            }
+            if ( n == 0 ) fail( file, lineOf(src, p), "bad \\x escape" );
+            break;
+        default:
+            if ( *p >= '0' && *p <= '7' ) {
+                for ( v = 0, n = 0; n < 3 && *p >= '0' && *p <= '7'; n++, p++ ) {
+                    v = v * 8 + (*p - '0');
+                }
+            }
+            else {
+                v = *(p++);
+            }
+            break;
+        }
+        out[(*len)++] = (unsigned char) v;
+    }
+    return p + 1;
+}
+
+static void addText( const char *id, unsigned char *raw, int len, const char *file, int line )
+{
+    int i;
+    for ( i = 0; i < len; i++ ) {
+        if ( raw[i] == 0 || raw[i] >= 0x80 ) fail( file, line, "packed text must be 7 bit ASCII without NULL" );
+    }
+    for ( i = 0; i < textCount; i++ ) {
+        if ( 0 == strcmp(texts[i].id, id) ) {
+            if ( texts[i].rawLen != len || memcmp(texts[i].raw, raw, len) ) {
+                fail( file, line, "CLI_TEXT id reused with different text" );
+            }
+            free( raw );
+            return;
+        }
+    }
+    if ( textCount == MAX_TEXTS ) fail( file, line, "too many texts" );
+
+    Text_t *t = &texts[textCount++];
+    snprintf( t->id, sizeof(t->id), "%s", id );
+    t->raw = raw;
+    t->rawLen = len;
+    t->sym = malloc( (len + 1) * sizeof(int) );
+    for ( i = 0; i < len; i++ ) t->sym[i] = raw[i];
+    t->symLen = len;
+    t->dup = -1;
+}
+
+// Find every CLI_TEXT(ID, "literal" ...) in a source file
+static void scanFile( const char *path )
+{
+    char *src = readFile( path );
+    const char *p = src;
+    char id[MAX_ID];
+    int n;
+
+    while ( (p = strstr(p, "CLI_TEXT(")) != NULL ) {
+        const char *start = p;
+        p = skipSpace( p + 9 );
+        for ( n = 0; (isalnum((unsigned char) *p) || *p == '_') && n < MAX_ID - 1; n++ ) {
+            id[n] = *(p++);
+        }
+        id[n] = 0;
+        p = skipSpace( p );
+        if ( n == 0 || *p != ',' ) continue;
+        p = skipSpace( p + 1 );
+        if ( *p != '"' ) continue;      // Not a literal (e.g. the macro definition)
+
+        unsigned char *raw = malloc( strlen(p) + 1 );
+        int len = 0;
+        while ( *p == '"' ) {
+            p = skipSpace( parseLiteral(p, raw, &len, path, src) );
+        }
+        if ( *p != ')' ) fail( path, lineOf(src, p), "expected ')' after CLI_TEXT string" );
+        addText( id, raw, len, path, lineOf(src, start) );
+    }
+    free( src );
+}
+
+static unsigned long hashSym( const int *p, int len )
+{
+    unsigned long h = 2166136261UL;
+    int i;
+    for ( i = 0; i < len; i++ ) {
+        h = (h ^ (unsigned) p[i]) * 16777619UL;
+    }
+    return h;
+}
+
+static int symEqual( const int *a, const int *b, int len )
+{
+    return 0 == memcmp( a, b, len * sizeof(int) );
+}
+
+// Greedily pick the substring that saves the most bytes and replace it everywhere
+static int buildEntry( void )
+{
+    int i, j, len;
+    Candidate_t *best = NULL;
+    long bestGain = 0;
+
+    memset( table, 0, HASH_SIZE * sizeof(Candidate_t) );
+    for ( i = 0; i < textCount; i++ ) {
+        Text_t *t = &texts[i];
+        if ( t->dup >= 0 ) continue;
+        for ( j = 0; j < t->symLen; j++ ) {
+            if ( t->sym[j] >= 0x80 ) continue;
+            for ( len = MIN_ENTRY; len <= MAX_ENTRY && j + len <= t->symLen; len++ ) {
+                if ( t->sym[j + len - 1] >= 0x80 ) break;   // Entries only hold literals
+                unsigned long h = hashSym( &t->sym[j], len ) & (HASH_SIZE - 1);
+                while ( table[h].p != NULL &&
+                        (table[h].len != len || !symEqual(table[h].p, &t->sym[j], len)) ) {
+                    h = (h + 1) & (HASH_SIZE - 1);
+                }
+                table[h].p = &t->sym[j];
+                table[h].len = len;
+                table[h].count++;
+            }
+        }
+    }
+
+    for ( i = 0; i < HASH_SIZE; i++ ) {
+        // Each use saves len - 1 bytes, the entry costs len bytes plus its offset
+        long gain = (long) table[i].count * (table[i].len - 1) - (table[i].len + 2);
+        if ( table[i].p != NULL && gain > bestGain ) {
+            bestGain = gain;
+            best = &table[i];
+        }
+    }
+    if ( best == NULL ) return 0;
+
+    int entry[MAX_ENTRY];
+    len = best->len;
+    for ( i = 0; i < len; i++ ) {
+        entry[i] = best->p[i];
+        dict[dictCount][i] = (unsigned char) best->p[i];
+    }
+    dictLen[dictCount] = len;
+
+    for ( i = 0; i < textCount; i++ ) {
+        Text_t *t = &texts[i];
+        int r = 0, w = 0;
+        while ( r < t->symLen ) {
+            if ( r + len <= t->symLen && symEqual(&t->sym[r], entry, len) ) {
+                t->sym[w++] = 0x80 | dictCount;
+                r += len;
+            }
+            else {
+                t->sym[w++] = t->sym[r++];
+            }
+        }
+        t->symLen = w;
+    }
+    ++dictCount;
+    return 1;
+}
+
+static void emitByte( FILE *out, int b, long *col )
+{
+    fprintf( out, "%s0x%02x,", ((*col)++ % 12)? " " : "\n    ", b );
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *outPath = "AJScliText.h";
+    int i, j, files = 0;
+
+    for ( i = 1; i < argc; i++ ) {
+        if ( 0 == strcmp(argv[i], "-o") && i + 1 < argc ) {
+            outPath = argv[++i];
+        }
+        else {
+            scanFile( argv[i] );
+            ++files;
+        }
+    }
+    if ( files == 0 ) {
+        fprintf( stderr, "usage: %s [-o AJScliText.h] file.c [file.c ...]\n", argv[0] );
+        return 1;
+    }
+
+    // Identical texts share one copy in the blob
+    long rawTotal = 0;
+    for ( i = 0; i < textCount; i++ ) {
+        rawTotal += texts[i].rawLen + 1;
+        for ( j = 0; j < i; j++ ) {
+            if ( texts[j].dup < 0 && texts[j].rawLen == texts[i].rawLen &&
+                 0 == memcmp(texts[j].raw, texts[i].raw, texts[i].rawLen) ) {
+                texts[i].dup = j;
+                break;
+            }
+        }
+    }
+
+    table = malloc( HASH_SIZE * sizeof(Candidate_t) );
+    while ( dictCount < MAX_DICT && buildEntry() );
+
+    // Layout: u16 count, u16 offsets[count + 1], entries, NULL terminated texts
+    long offset = 2 + 2 * (dictCount + 1);
+    long entryOffset[MAX_DICT + 1];
+    for ( i = 0; i <= dictCount; i++ ) {
+        entryOffset[i] = offset;
+        if ( i < dictCount ) offset += dictLen[i];
+    }
+    if ( offset > 0xFFFF ) {
+        fprintf( stderr, "dictionary too large\n" );
+        return 1;
+    }
+    for ( i = 0; i < textCount; i++ ) {
+        if ( texts[i].dup >= 0 ) continue;
+        texts[i].offset = offset;
+        offset += texts[i].symLen + 1;
+    }
+    if ( offset >= (1L << 21) ) {
+        fprintf( stderr, "text blob too large\n" );
+        return 1;
+    }
+
+    FILE *out = fopen( outPath, "w" );
+    if ( out == NULL ) {
+        perror( outPath );
+        return 1;
+    }
+
+    fprintf( out, "/* Generated by tools/clitext, do not edit. */\n" );
+    fprintf( out, "/* %d texts, %ld bytes packed into %ld bytes. */\n\n", textCount, rawTotal, offset );
+    fprintf( out, "#ifndef AJS_CLI_TEXT_H\n#define AJS_CLI_TEXT_H\n\n" );
+    for ( i = 0; i < textCount; i++ ) {
+        long o = texts[ (texts[i].dup >= 0)? texts[i].dup : i ].offset;
+        fprintf( out, "#define CLI_TEXT_%-32s \"\\x01\\x%02lx\\x%02lx\\x%02lx\"\n", texts[i].id,
+            0x80 | (o & 0x7F), 0x80 | ((o >> 7) & 0x7F), 0x80 | ((o >> 14) & 0x7F) );
+    }
+    fprintf( out, "\nextern const unsigned char cliTextBlob[];\n\n#endif /* AJS_CLI_TEXT_H */\n\n" );
+
+    fprintf( out, "#if defined(AJS_CLI_TEXT_BLOB) && !defined(AJS_CLI_TEXT_BLOB_DEFINED)\n" );
+    fprintf( out, "#define AJS_CLI_TEXT_BLOB_DEFINED\n" );
+    fprintf( out, "const unsigned char cliTextBlob[%ld] = {", offset );
+    long col = 0;
+    emitByte( out, dictCount & 0xFF, &col );
+    emitByte( out, dictCount >> 8, &col );
+    for ( i = 0; i <= dictCount; i++ ) {
+        emitByte( out, entryOffset[i] & 0xFF, &col );
+        emitByte( out, entryOffset[i] >> 8, &col );
+    }
+    for ( i = 0; i < dictCount; i++ ) {
+        for ( j = 0; j < dictLen[i]; j++ ) emitByte( out, dict[i][j], &col );
+    }
+    for ( i = 0; i < textCount; i++ ) {
+        if ( texts[i].dup >= 0 ) continue;
+        for ( j = 0; j < texts[i].symLen; j++ ) emitByte( out, texts[i].sym[j], &col );
+        emitByte( out, 0, &col );
+    }
+    fprintf( out, "\n};\n#endif /* AJS_CLI_TEXT_BLOB */\n" );
+    fclose( out );
+
+    printf( "%s: %d texts, %d dictionary entries, %ld -> %ld bytes\n",
+        outPath, textCount, dictCount, rawTotal, offset );
+    return 0;
+}
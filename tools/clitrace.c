@@ -0,0 +1,163 @@
+/*******************************************************************
+
+                Adam Seidman CLI Trace Decoder
+
+********************************************************************
+
+ File Name:             clitrace.c
+ Compiler:              ANSI C (host)
+ Author:                Adam Seidman
+ License:               MIT
+
+ Finds the output of the 'trace' command in a captured console
+ stream and renders it as a timeline with echo latency summary.
+
+    clitrace [capture.bin]
+
+*******************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "AJScli.h"
+
+#define MAX_LISTS           (256)
+
+static const char *actionNames[] = {
+    "none", "up", "down", "right", "left", "home", "end", "insert", "delete",
+    "word-right", "word-left", "paste-begin", "paste-end",
+};
+
+static char **names[MAX_LISTS];
+static int nameCount[MAX_LISTS];
+
+static const unsigned char *buf;
+static long bufLen, pos;
+
+static unsigned long get( int bytes )
+{
+    unsigned long v = 0;
+    int i;
+    if ( pos + bytes > bufLen ) {
+        fprintf( stderr, "trace truncated\n" );
+        exit( 1 );
+    }
+    for ( i = 0; i < bytes; i++ ) {
+        v |= (unsigned long) buf[pos++] << (8 * i);
+    }
+    return v;
+}
+
+static const char *commandName( int list, int idx )
+{
+    if ( list < MAX_LISTS && idx < nameCount[list] ) return names[list][idx];
+    return "?";
+}
+
+int main( int argc, char *argv[] )
+{
+    FILE *f = (argc > 1)? fopen( argv[1], "rb" ) : stdin;
+    if ( f == NULL ) {
+        perror( argv[1] );
+        return 1;
+    }
+
+    long cap = 1 << 16;
+    unsigned char *data = malloc( cap );
+    size_t n;
+    bufLen = 0;
+    while ( (n = fread(data + bufLen, 1, cap - bufLen, f)) > 0 ) {
+        bufLen += n;
+        if ( bufLen == cap ) data = realloc( data, cap *= 2 );
+    }
+    buf = data;
+
+    // Use the last dump in the capture
+    const char *magic = CLI_TRACE_MAGIC;
+    long magicLen = (long) strlen( magic ), start = -1, i;
+    for ( i = 0; i + magicLen <= bufLen; i++ ) {
+        if ( 0 == memcmp(buf + i, magic, magicLen) ) start = i;
+    }
+    if ( start < 0 ) {
+        fprintf( stderr, "no trace found\n" );
+        return 1;
+    }
+    pos = start + magicLen;
+
+    if ( get(1) != CLI_TRACE_VERSION ) {
+        fprintf( stderr, "unsupported trace version\n" );
+        return 1;
+    }
+    double tickMs = 1000.0 / (double) get( 4 );
+    unsigned long count = get( 2 );
+    long events = pos;
+    pos += count * 8;
+
+    // Command names follow the events
+    int list;
+    while ( (list = (int) get(1)) != 0xFF ) {
+        nameCount[list] = (int) get( 2 );
+        names[list] = calloc( nameCount[list], sizeof(char *) );
+        for ( i = 0; i < nameCount[list]; i++ ) {
+            names[list][i] = (char *) buf + pos;
+            while ( get(1) != 0 );
+        }
+    }
+
+    pos = events;
+    unsigned long first = 0, prev = 0, rxTick = 0;
+    int waitingEcho = 0, echoCount = 0;
+    double echoSum = 0, echoMax = 0;
+
+    printf( "%12s %10s  event\n", "time(ms)", "delta(ms)" );
+    for ( i = 0; i < (long) count; i++ ) {
+        unsigned long tick = get( 4 );
+        int type = (int) get( 1 );
+        int arg8 = (int) get( 1 );
+        int arg16 = (int) get( 2 );
+        if ( i == 0 ) first = prev = tick;
+
+        printf( "%12.3f %10.3f  ", (tick - first) * tickMs, (tick - prev) * tickMs );
+        switch ( type ) {
+        case CLI_TRACE_EV_RX:
+            printf( "rx       0x%02x %c\n", arg8, (arg8 >= CLI_CHAR_PRINT_MIN && arg8 <= CLI_CHAR_PRINT_MAX)? arg8 : '.' );
+            if ( !waitingEcho ) rxTick = tick;
+            waitingEcho = 1;
+            break;
+        case CLI_TRACE_EV_ESC:
+            printf( "escape   %s\n", (arg8 < (int) (sizeof(actionNames) / sizeof(actionNames[0])))? actionNames[arg8] : "?" );
+            break;
+        case CLI_TRACE_EV_DISPATCH:
+            printf( "dispatch %s\n", commandName(arg8, arg16) );
+            break;
+        case CLI_TRACE_EV_RETURN:
+            printf( "return   %d\n", (short) arg16 );
+            break;
+        case CLI_TRACE_EV_FLUSH:
+            printf( "flush    %d bytes\n", arg16 );
+            if ( waitingEcho ) {
+                double latency = (tick - rxTick) * tickMs;
+                echoSum += latency;
+                if ( latency > echoMax ) echoMax = latency;
+                ++echoCount;
+                waitingEcho = 0;
+            }
+            break;
+        case CLI_TRACE_EV_MSG:
+            printf( "message  %d bytes\n", arg16 );
+            break;
+        default:
+            printf( "unknown  %d\n", type );
+            break;
+        }
+        prev = tick;
+    }
+
+    if ( echoCount > 0 ) {
+        printf( "\nrx to output: %d samples, avg %.3f ms, max %.3f ms\n",
+            echoCount, echoSum / echoCount, echoMax );
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*******************************************************************
+
+                Adam Seidman CLI Output Decompressor
+
+********************************************************************
+
+ File Name:             clizip.c
+ Compiler:              ANSI C (host), POSIX for the terminal mode
+ Author:                Adam Seidman
+ License:               MIT
+
+ Expands the frames sent after 'compress on'; other bytes and
+ frames pass through unchanged.
+
+    clizip < capture.bin            decode a capture to stdout
+    clizip /dev/ttyUSB0             terminal: sends 'compress on',
+                                    keys go to the port, Ctrl-] quits
+
+ Configure the port (baud, raw) with stty before starting.
+
+*******************************************************************/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "AJScli.h"
+
+#define CLIZIP_QUIT         (0x1D)      // Ctrl-]
+
+static unsigned char window[CLI_ZIP_WINDOW];
+static unsigned int windowPos;
+
+// Stream parser state, fed one byte at a time
+static enum { ST_TEXT, ST_START, ST_LEN0, ST_LEN1, ST_FLAGS, ST_ITEM, ST_MATCH } state = ST_TEXT;
+static unsigned int frameLen, flags, items, distance;
+static int supported;
+
+static void emit( int c )
+{
+    window[windowPos++ % CLI_ZIP_WINDOW] = (unsigned char) c;
+    putchar( c );
+}
+
+static void feed( int c )
+{
+    int payload = ( state == ST_FLAGS || state == ST_ITEM || state == ST_MATCH );
+
+    switch ( state ) {
+    case ST_TEXT:
+        // Uncompressed output is part of the history too
+        if ( c == CLI_ZIP_FRAME_START ) state = ST_START;
+        else emit( c );
+        break;
+    case ST_START:
+        if ( c == CLI_ZIP_FRAME_TYPE ) {
+            state = ST_LEN0;
+        }
+        else {
+            // Some other frame (log, trace), pass it through
+            putchar( CLI_ZIP_FRAME_START );
+            putchar( c );
+            state = ST_TEXT;
+        }
+        break;
+    case ST_LEN0:
+        frameLen = (unsigned int) c;
+        state = ST_LEN1;
+        break;
+    case ST_LEN1:
+        frameLen |= (unsigned int) c << 8;
+        if ( frameLen == 0 ) {
+            // Reply to 'compress on': new stream
+            windowPos = 0;
+            supported = 1;
+        }
+        items = 8;
+        state = frameLen? ST_FLAGS : ST_TEXT;
+        break;
+    case ST_FLAGS:
+        flags = (unsigned int) c;
+        items = 0;
+        state = ST_ITEM;
+        break;
+    case ST_ITEM:
+        if ( flags & (1u << items) ) {
+            distance = (unsigned int) c + 1;
+            state = ST_MATCH;
+            break;
+        }
+        emit( c );
+        ++items;
+        break;
+    case ST_MATCH: {
+        unsigned int len = (unsigned int) c + CLI_ZIP_MATCH_MIN;
+        while ( len-- ) {
+            emit( window[(windowPos - distance) % CLI_ZIP_WINDOW] );
+        }
+        ++items;
+        state = ST_ITEM;
+        break;
+    }
+    }
+
+    if ( payload && --frameLen == 0 ) {
+        state = ST_TEXT;
+    }
+    else if ( state == ST_ITEM && items == 8 ) {
+        state = ST_FLAGS;
+    }
+}
+
+static int terminal( const char *path )
+{
+    struct termios saved, raw;
+    unsigned char buf[512];
+    int fd = open( path, O_RDWR | O_NOCTTY );
+
+    if ( fd < 0 ) {
+        perror( path );
+        return 1;
+    }
+    int tty = isatty( STDIN_FILENO );
+    if ( tty ) {
+        tcgetattr( STDIN_FILENO, &saved );
+        raw = saved;
+        cfmakeraw( &raw );
+        tcsetattr( STDIN_FILENO, TCSANOW, &raw );
+    }
+
+    const char *hello = "compress on\r";
+    if ( write( fd, hello, strlen( hello ) ) < 0 ) perror( path );
+
+    for ( ;; ) {
+        fd_set rd;
+        FD_ZERO( &rd );
+        FD_SET( STDIN_FILENO, &rd );
+        FD_SET( fd, &rd );
+        if ( select( fd + 1, &rd, NULL, NULL, NULL ) < 0 ) break;
+
+        if ( FD_ISSET( fd, &rd ) ) {
+            ssize_t n = read( fd, buf, sizeof(buf) ), i;
+            if ( n <= 0 ) break;
+            for ( i = 0; i < n; i++ ) feed( buf[i] );
+            fflush( stdout );
+        }
+        if ( FD_ISSET( STDIN_FILENO, &rd ) ) {
+            ssize_t n = read( STDIN_FILENO, buf, sizeof(buf) );
+            if ( n <= 0 || memchr( buf, CLIZIP_QUIT, n ) != NULL ) break;
+            if ( write( fd, buf, n ) < 0 ) break;
+        }
+    }
+
+    // Leave the target readable by a plain terminal
+    const char *bye = "compress off\r";
+    if ( write( fd, bye, strlen( bye ) ) < 0 ) perror( path );
+    if ( tty ) tcsetattr( STDIN_FILENO, TCSANOW, &saved );
+    close( fd );
+    if ( !supported ) fprintf( stderr, "\r\nclizip: target did not acknowledge 'compress on'\r\n" );
+    return 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    int c;
+
+    if ( argc > 1 ) {
+        return terminal( argv[1] );
+    }
+    while ( (c = getchar()) != EOF ) {
+        feed( c );
+    }
+    return 0;
+}